@@ -7,7 +7,7 @@
 /*
 ----------COSAS A CONSIDERAR----------
 
-Memoria de 1000 palabras.
+Memoria de 1000 palabras (se puede cambiar al compilar, ver ADDRDIGITS y WORDDIGITS).
 
 Una palabra consiste de seis números:
 [ 5 | 4 | 3 | 2 | 1 | 0 ]
@@ -27,6 +27,11 @@ LDA, STA, CLA, ADD, SUB, NOP, NEG, HLT, JMP (opcional)
 Tipos de direccionamiento:
 Absoluto (1), indirecto (2), inmediato (3), relativo (4).
 
+Compilación (requiere C++17 e hilos):
+  g++ -std=c++17 -O2 -pthread Simulator.cpp -o Simulator
+  (con -march=native el motor SIMD usa AVX2 si el procesador lo tiene; si no, SSE2).
+  Con -DADDRDIGITS=6 -DWORDDIGITS=8 se compila una máquina de un millón de palabras.
+
 ---------------LOG---------------
 (Si cambian algo pongan qué cambiaron y el día y hora. :))
   + Adición al programa
@@ -54,30 +59,104 @@ Absoluto (1), indirecto (2), inmediato (3), relativo (4).
              + Agregamos la funcion que muestra como se van realizando las microoperaciones.
              + Agregamos la opcion de decidir el tiempo que toma cada microoperacion en ejecutarse.
              + Acabamos todo.
+17/oct 10:00 + Modo de ejecución sin menú desde la línea de comandos (programa, límite de pasos y
+               formato de salida), sin animación de microoperaciones y con volcado final del estado.
+             * Separamos la carga de archivos y la ejecución de una instrucción en sus propias funciones.
+17/oct 11:00 * La memoria y los registros MDR, AC, IR ahora son palabras empacadas en un entero (Word) y
+               MAR es un entero; el texto sólo se usa al mostrar o al ensamblar.
+17/oct 12:00 + Tabla de instrucciones predecodificadas (decoded) que se actualiza al cargar o editar la
+               memoria y en cada escritura de STA, para no decodificar IR en cada paso.
+17/oct 13:00 + Motores rápidos para el modo sin menú: tabla de manejadores por (operación, direccionamiento)
+               y goto calculado con GCC/Clang. Se elige el motor con --engine.
+17/oct 14:00 + Superinstrucciones: secuencias frecuentes (LDA/ADD/STA, CLA/ADD INM, ...) se ejecutan con un
+               solo despacho en los motores rápidos. Se desactivan con --no-fusion.
+17/oct 15:00 + Motor JIT para Linux x86-64 (--engine jit) que traduce bloques básicos a código nativo.
+17/oct 16:00 + Traducción anticipada de la memoria a un programa de C++ (--aot).
+17/oct 17:00 * La memoria, los registros y el estado de ejecución ahora están en la clase Machine; el menú
+               usa la máquina global sim.
+             + Modo por lotes (--batch): ejecuta muchos programas en paralelo con un grupo de hilos que se
+               roban trabajo y escribe los resultados en el orden de entrada.
+17/oct 18:00 + Motor SIMD (--variants): ejecuta un programa con muchas variantes de sus celdas a la vez,
+               con la memoria y los registros como estructura de arreglos y operaciones AVX2/SSE2.
+17/oct 19:00 + Bifurcación de máquinas (Machine::fork y --fork-at): se ejecuta el programa hasta un paso y
+               se continúa desde ahí una copia por variante, sin volver a cargarlo.
+             * Las copias no comparten memoria (los motores usan data como arreglo contiguo); --fork-at limita
+               los hilos para que las copias vivas no pasen de FORKBUDGET bytes.
+17/oct 20:00 + Programas de medición en benchmarks/ y modo --benchmark, que reporta instrucciones y
+               microoperaciones por segundo de cada motor, tiempo de carga y memoria máxima (texto o JSON).
+17/oct 21:00 + Perfil de ejecución del motor clásico (--profile y opción del menú): ejecuciones y
+               microoperaciones por dirección, operación y direccionamiento, lecturas y escrituras por celda
+               y mapa de calor de la memoria. Sin perfil no se compila ningún contador en el ciclo.
+17/oct 22:00 + --benchmark lee en Linux los contadores del procesador (ciclos, instrucciones, fallos de
+               predicción de saltos y de la caché L1 de datos) y reporta ciclos por instrucción simulada.
+17/oct 23:00 * La animación de las microoperaciones usa secuencias ANSI y sólo reescribe los renglones que
+               cambiaron desde la imagen anterior, con un máximo de MAXFPS imágenes por segundo.
+             + Opción para volver al redibujado completo en terminales sin ANSI.
+18/oct 00:00 * Funciones de formato (formatNumber, formatAddress, formatAssembly) que escriben en arreglos
+               en la pila con to_chars; la pantalla de la animación ya no reserva memoria en cada imagen.
+18/oct 01:00 * La animación se dibuja en su propio hilo: la ejecución publica los cambios de los registros
+               y las celdas escritas en una cola circular sin candados y nunca espera a la terminal.
+18/oct 02:00 * El intervalo entre microoperaciones acepta fracciones de segundo y se mide igual en todos los
+               sistemas (antes WAIT tomaba microsegundos en Linux y milisegundos en Windows), con plazos
+               absolutos que no acumulan retraso.
+             + Opción de velocidad máxima y multiplicadores del intervalo por tipo de microoperación.
+18/oct 03:00 + Índice de celdas ocupadas (mapa de bits) y ensamblador de cada celda guardado; las vistas de la
+               memoria sólo recorren las celdas ocupadas y no vuelven a convertir las instrucciones.
+18/oct 04:00 + Depuración (opción 8 del menú): puntos de interrupción en direcciones, celdas vigiladas y
+               valor del AC vigilado. Se ejecuta a toda velocidad con el motor goto hasta que algo se
+               cumple y desde ahí se puede continuar o ver la animación de las microoperaciones.
+18/oct 05:00 + Historial de la depuración para retroceder: instantáneas periódicas de la máquina y los cambios
+               de cada instrucción en anillos de tamaño fijo.
+             * Las instantáneas se reservan al tomarlas y el historial no acepta más de HISTORYBUDGET bytes.
+18/oct 06:00 + Puntos de control de las ejecuciones sin menú (--checkpoint): se escriben cada cierto número de
+               instrucciones con escritura atómica y --resume continúa exactamente desde el último.
+18/oct 07:00 + Trazo binario de la ejecución (--trace) y su reproductor (--replay): reconstruye cualquier paso
+               y puede mostrarlo con la animación.
+18/oct 08:00 + Imagen binaria de la memoria (.simg): se guarda desde el menú (opción 9) o con --save-image y
+               se carga con mmap sin ensamblar en cualquier lugar donde se carga un programa.
+18/oct 09:00 * Un solo ensamblador para la carga de archivos, la edición de la memoria y el modo sin menú: lee
+               el archivo proyectado en memoria (o la entrada estándar con -) sin copiar líneas, busca las
+               operaciones con un hash perfecto y reporta todos los errores con su línea en una pasada.
+             - toUpper, getOpCode y getAddrType.
+18/oct 10:00 * El tamaño de la memoria, los dígitos de las direcciones y de los datos y la posición de los campos
+               de una instrucción salen de WordFormat<WORDDIGITS, ADDRDIGITS>, fijos al compilar (por omisión
+               la máquina clásica, sin cambios en su código ni en sus formatos de archivo).
+             * --aot sólo genera etiquetas y casos del despachador para las celdas con instrucción; las demás
+               las recorre un ciclo genérico, así que el programa no crece con MEMSIZE.
+             * Machine no es plantilla: sigue tomando el tamaño de Format y cuesta unos 72 MB por máquina con
+               ADDRDIGITS=6 (ver la descripción de WordFormat).
+             * El mapa de calor del perfil conserva la cuadrícula de 100 x 10 agrupando MEMSIZE / 1000 celdas por
+               carácter cuando la memoria es más grande.
 */
 
-// Identificar y hacer la configuración necesaria según el sistema operativo para la función de esperar.
+// Identificar y hacer la configuración necesaria según el sistema operativo.
+// (Las esperas de la animación usan Pacer, que mide igual en todos los sistemas.)
 #ifdef _WIN32
    // Library and definitions for Windows (32-bit and 64-bit).
    #include <windows.h>
-   #define WAIT Sleep
-   #define CONV 1000
 #elif __APPLE__
     // Library and definitios for Apple devices.
     #include <unistd.h>
-    #define WAIT usleep
-    #define CONV 1
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
 #elif __linux__
     // Library  and definitios for Linux systems.
     #include <unistd.h>
-    #define WAIT usleep
-	#define CONV 1
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <linux/perf_event.h>
 #elif __unix__
 	// All Unices not caught above.
     // Unix
     #include <unistd.h>
-    #define WAIT usleep
-		#define CONV 1
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
 #else
     #error "Unknown compiler"
 #endif
@@ -85,1241 +164,6524 @@ Absoluto (1), indirecto (2), inmediato (3), relativo (4).
 #include <iostream>
 #include <locale.h>
 #include <iomanip>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <string>
+#include <string_view>
 #include <fstream>
 #include <sstream>
-
-#define MEMSIZE 1000
+#include <vector>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <filesystem>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+// Intrínsecos del motor SIMD (AVX2 si se compila con -mavx2 o -march=native).
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
+/*
+  Tamaño de la máquina, fijo al compilar (por omisión la máquina clásica de 1000 palabras de seis caracteres):
+    ADDRDIGITS  dígitos de una dirección y del parámetro de las instrucciones; hay 10^ADDRDIGITS palabras.
+    WORDDIGITS  dígitos de un dato, que va de -(10^WORDDIGITS - 1) a +(10^WORDDIGITS - 1).
+  Por ejemplo, -DADDRDIGITS=6 -DWORDDIGITS=8 compila una máquina de un millón de palabras (LDA ABS 123456,
+  +12345678). Los programas, las imágenes, los puntos de control y los trazos son de una sola configuración.
+
+  Sólo los límites (WordFormat) son una plantilla; Machine no lo es. Se eligió así para no convertir en plantillas
+  los motores, el menú y los formatos de archivo: cada ejecutable tiene una sola configuración, y Format la da a
+  todo el código. El costo es que Machine guarda en línea sus arreglos de MEMSIZE elementos (memoria,
+  predecodificación, ensamblador guardado y tablas del JIT): unos 70 KB en la máquina clásica y unos 72 MB con
+  ADDRDIGITS=6. La máquina del menú (sim) ocupa eso en bss, y el modo por lotes y --fork-at reservan una máquina
+  completa por programa o por bifurcación, así que con memorias grandes conviene limitar -j y las variantes.
+*/
+#ifndef ADDRDIGITS
+#define ADDRDIGITS 3
+#endif
+#ifndef WORDDIGITS
+#define WORDDIGITS 5
+#endif
+
+// Potencia de 10 y número de bits de un entero, para calcular los límites al compilar.
+constexpr int powerOf10(int n) { return n == 0 ? 1 : 10 * powerOf10(n - 1); }
+constexpr int bitsFor(int n) { return n == 0 ? 0 : 1 + bitsFor(n >> 1); }
+
+/*
+  Límites de una máquina con datos de WordDigits dígitos y direcciones de AddrDigits dígitos, y posición de los
+  campos de una instrucción en la palabra empacada (ver Word). Todo es constante al compilar, así que la máquina
+  clásica se compila igual que cuando estos valores estaban escritos a mano.
+*/
+template <int WordDigits, int AddrDigits>
+struct WordFormat {
+  static constexpr int memSize = powerOf10(AddrDigits);
+  static constexpr int maxValue = powerOf10(WordDigits) - 1;
+  static constexpr int maxParam = powerOf10(AddrDigits) - 1;
+
+  // Magnitud del parámetro en los bits bajos; encima el signo (2 bits), el tipo de direccionamiento (4) y el
+  // código de operación (4), todo debajo del bit WORD_INST.
+  static constexpr int paramBits = bitsFor(maxParam);
+  static constexpr int paramMask = (1 << paramBits) - 1;
+  static constexpr int signShift = paramBits, addrShift = paramBits + 2, opShift = paramBits + 6;
+  static constexpr int instBits = opShift + 4;
+
+  // Caracteres de una palabra escrita: el signo y los dígitos de un dato, o la operación, el tipo y el parámetro.
+  static constexpr int dataChars = WordDigits + 1, instChars = AddrDigits + 3;
+
+  static_assert(AddrDigits >= 2, "el parámetro con signo necesita al menos ADDRDIGITS = 2");
+  static_assert(instBits <= 30, "las instrucciones no caben en la palabra empacada (ADDRDIGITS <= 6)");
+  static_assert(WordDigits >= 1 && WordDigits <= 9, "los datos no caben en la palabra empacada (WORDDIGITS <= 9)");
+};
+
+typedef WordFormat<WORDDIGITS, ADDRDIGITS> Format;
+
+#define MEMSIZE Format::memSize
+
 // Arreglos con los códigos de operación.
 //                 00     01     02      03     04     05    06     07     08
 string codes[] = {"NOP", "CLA", "LDA", "STA", "ADD", "SUB", "NEG", "JMP", "HLT"};
-// Arreglo de la memoria del simulador.
-string data[MEMSIZE];
-// Opciones.
-bool showWholeMemory = false, onlyShowErrors = false;
-// Valor del PC inicial
-int PC = 0, PCprev;
-// Otros registros
-string MDR, AC, MAR, IR;
-// Duración del intervalo de ejecución de las microoperaciones.
-int secs = 3;
-
-// Función que obtiene el código de operación según un string.
-// Parámetro: el string con la operación (por ejemplo: "LDA").
-// Valor de retorno: int del código de operación (por ejemplo: 2).
-int getOpCode(string operation) {
-    for(int i=0; i<9; i++) {
-        if(codes[i] == operation)
-            return i;
-    }
-    return -1;
-}
-
-// Función que obtiene el tipo de direccionamiento según un string.
-// Parámetro: el string con una letra que representa el tipo (por ejemplo: "ABS").
-// Valor de retorno: int del tipo de direccionamiento (por ejemplo: 1).
-int getAddrType(string input) {
-    if(input == "ABS")
-        return 1;
-    if(input == "IND")
-        return 2;
-    if(input == "INM")
-        return 3;
-    if(input == "REL")
-        return 4;
-    return -1;
-}
 
-// Función que convierte un string a mayúsculas.
-// Parámetros: el string por modificar.
-// Valor de retorno: el string en mayúsculas.
-string toUpper(string str) {
-    string result = "";
-    for(int i = 0; i < str.length(); i++) {
-        result += toupper(str[i]);
-    }
-    return result;
-}
+/*
+  Palabra de la memoria empacada en un entero de 32 bits.
+    Dato:        el propio valor, de -MAXVALUE a +MAXVALUE (-99999 a +99999 en la máquina clásica).
+    Vacía:       WORD_EMPTY.
+    Instrucción: bit 30 encendido; bits 19-16 código de operación, bits 15-12 tipo de direccionamiento,
+                 bits 11-10 signo del parámetro (0 sin signo, 1 '+', 2 '-') y bits 9-0 su magnitud
+                 (con otro ADDRDIGITS los campos se recorren según Format::paramBits).
+  Así ADD/SUB/LDA trabajan directamente con enteros y sólo se convierte a texto al mostrar o al ensamblar.
+*/
+#define WORD_EMPTY INT32_MIN
+#define WORD_INST 0x40000000
+#define MAXVALUE Format::maxValue
+
+struct Word {
+  int32_t bits;
+
+  bool isEmpty() const { return bits == WORD_EMPTY; }
+  bool isData() const { return bits >= -MAXVALUE && bits <= MAXVALUE; }
+  bool isInstruction() const { return bits >= WORD_INST; }
+
+  int opCode() const { return (bits >> Format::opShift) & 0xF; }
+  int addrType() const { return (bits >> Format::addrShift) & 0xF; }
+  int paramSign() const { return (bits >> Format::signShift) & 0x3; }
+  int paramMag() const { return bits & Format::paramMask; }
+  int param() const { return paramSign() == 2 ? -paramMag() : paramMag(); }
+
+  // Valor numérico de la palabra, igual al que daba atoi() sobre su texto:
+  // un dato es su valor, una palabra vacía es 0 y una instrucción se lee como número hasta el signo del parámetro.
+  int value() const {
+    if(isData())
+      return bits;
+    if(isEmpty())
+      return 0;
+    if(paramSign() != 0)
+      return opCode() * 10 + addrType();
+    return (opCode() * 10 + addrType()) * (Format::maxParam + 1) + paramMag();
+  }
 
-// Función que convierte un entero a un string.
-// Parámetro: el número entero.
-// Valor de retorno: string con el entero convertido.
-string toString(int num) {
-	ostringstream str;
-  str << num;
-  return str.str();
-}
+  static Word empty() { Word w; w.bits = WORD_EMPTY; return w; }
+  static Word fromValue(int value) { Word w; w.bits = value; return w; }
+  static Word instruction(int opCode, int addrType, int paramSign, int paramMag) {
+    Word w;
+    w.bits = WORD_INST | (opCode << Format::opShift) | (addrType << Format::addrShift)
+        | (paramSign << Format::signShift) | paramMag;
+    return w;
+  }
 
+  bool operator==(const Word &other) const { return bits == other.bits; }
+  bool operator!=(const Word &other) const { return bits != other.bits; }
+};
+
+// Instrucción predecodificada: código de operación, tipo de direccionamiento y parámetro como enteros.
+// Las celdas que no contienen una instrucción tienen opCode = NOTINST.
+#define NOTINST 0xFF
+
+struct DecodedInst {
+  uint8_t opCode;
+  uint8_t addrType;
+  uint8_t handler;
+  // Con direcciones de más de cuatro dígitos el parámetro ya no cabe en 16 bits.
+  conditional<(Format::maxParam > INT16_MAX), int32_t, int16_t>::type param;
+};
+
+// Manejadores de los motores rápidos, uno por combinación válida de operación y tipo de direccionamiento.
+// H_INVALID es una operación con parámetro y direccionamiento no válido (por ejemplo STA INM)
+// y H_JMP_INVALID un JMP con direccionamiento no válido, que no avanza el PC.
+enum HandlerId {
+  H_SKIP, H_NOP, H_CLA,
+  H_LDA_ABS, H_LDA_IND, H_LDA_INM, H_LDA_REL,
+  H_STA_ABS, H_STA_IND, H_STA_REL,
+  H_ADD_ABS, H_ADD_IND, H_ADD_INM, H_ADD_REL,
+  H_SUB_ABS, H_SUB_IND, H_SUB_INM, H_SUB_REL,
+  H_NEG,
+  H_JMP_ABS, H_JMP_IND, H_JMP_REL,
+  H_HLT, H_INVALID, H_JMP_INVALID,
+  // Punto de interrupción del menú de depuración (reemplaza al manejador de la celda).
+  H_BREAK,
+  // Superinstrucciones: se asignan a la primera celda de la secuencia.
+  F_LDA_ADD_STA,   // LDA ABS x / ADD ABS y / STA ABS z
+  F_LDA_SUB_STA,   // LDA ABS x / SUB ABS y / STA ABS z
+  F_LDA_ADDI_STA,  // LDA ABS x / ADD INM k / STA ABS z
+  F_CLA_ADDI,      // CLA / ADD INM k
+  HANDLERCOUNT
+};
+
+// Motores de ejecución disponibles para el modo sin menú.
+enum Engine { ENGINE_CLASSIC, ENGINE_TABLE, ENGINE_GOTO, ENGINE_JIT, ENGINECOUNT };
+// Nombres de los motores en la linea de comandos, en el mismo orden que Engine.
+const char *engineNames[ENGINECOUNT] = {"classic", "table", "goto", "jit"};
 
-// Función que vacía la memoria del simulador.
-// Parámetros: ninguno.
-// Valor de retorno: ninguno.
-void emptyMemory() {
-  for(int i = 0; i < MEMSIZE; i++) {
-    data[i] = "";
+// Opciones.
+bool showWholeMemory = false, onlyShowErrors = false, profileExecution = false, ansiScreen = true;
+// Duración del intervalo de ejecución de las microoperaciones, en segundos (acepta fracciones).
+double secs = 3;
+// Velocidad máxima: no esperar entre microoperaciones (se conserva el intervalo configurado).
+bool maxSpeed = false;
+
+// Tipos de microoperación, para ajustar el intervalo de cada uno con un multiplicador
+// (por ejemplo, para que los accesos a la memoria se vean más lentos que las transferencias entre registros).
+enum MicroOpKind { MO_REGISTER, MO_READ, MO_WRITE, MICROOPKINDS };
+double microopScale[MICROOPKINDS] = {1, 1, 1};
+
+// Historial de la depuración para retroceder: cada cuántas instrucciones se toma una instantánea de la máquina,
+// cuántas instantáneas y cuántos cambios de instrucciones se guardan como máximo.
+bool recordHistory = false;
+long long historyInterval = 65536;
+long long historySnapshots = 64, historyDeltas = 65536;
+// Memoria máxima del historial (instantáneas y cambios); la opción 6 de la depuración no acepta más.
+#define HISTORYBUDGET (1LL << 30)
+
+// Errores que se guardan por ejecución en modo sin menú.
+#define MAXDIAGNOSTICS 1000
+
+// Tamaño de los arreglos de las funciones de formato (formatNumber, formatAssembly, ...).
+#define FMTBUFSIZE 24
+// Palabras de 64 bits del mapa de celdas ocupadas (y de los de depuración).
+#define OCCUPIEDWORDS ((MEMSIZE + 63) / 64)
+
+// Motivo por el que se detuvo la ejecución hasta un punto de interrupción.
+enum BreakReason { BREAK_NONE, BREAK_ADDRESS, BREAK_WATCH, BREAK_AC };
+// Instrucciones que se ejecutan hasta un punto de interrupción antes de preguntar si se continúa
+// (sin saltos condicionales, un ciclo sin punto de interrupción no termina).
+#define DEBUGMAXSTEPS 100000000LL
+// Errores (con su número de instrucción) que se muestran en cada alto.
+#define DEBUGSHOWERRORS 5
+
+// Contadores del perfil de ejecución, que llena el motor clásico cuando la máquina tiene un perfil.
+// Las operaciones se cuentan por código (0 a 15) y PROFILEDATA cuenta las celdas sin instrucción que recorre el PC.
+// Los direccionamientos van de 1 a 4; el 0 es para las operaciones sin parámetro o con direccionamiento no válido.
+#define PROFILEDATA 16
+
+struct Profile {
+  long long execs[MEMSIZE], microops[MEMSIZE], reads[MEMSIZE], writes[MEMSIZE];
+  long long opExecs[PROFILEDATA + 1], opMicroops[PROFILEDATA + 1];
+  long long modeExecs[5];
+
+  // Cuenta una instrucción ejecutada en la dirección dir, con las microoperaciones que hizo.
+  void count(int dir, int opCode, int addrType, long long ops) {
+    int op = opCode == NOTINST ? PROFILEDATA : opCode;
+    bool hasParam = op == 2 || op == 3 || op == 4 || op == 5 || op == 7;
+    execs[dir]++;
+    microops[dir] += ops;
+    opExecs[op]++;
+    opMicroops[op] += ops;
+    modeExecs[hasParam && addrType >= 1 && addrType <= 4 ? addrType : 0]++;
   }
-}
+};
 
 /*
-	Función que limpia la pantalla.
-  Parámetros: ninguno.
-  Valor de retorno: ninguno.
+  Historial de la ejecución para retroceder en la depuración.
+
+  Antes de cada instrucción se guarda un cambio: los registros y, si la instrucción escribe, la celda y su valor
+  anterior (writeMemory() lo completa). Retroceder dentro de los cambios guardados sólo los deshace. Para ir más
+  atrás se restaura la instantánea más cercana anterior (registros y memoria completa, una cada interval
+  instrucciones) y se vuelve a ejecutar desde ella hasta la instrucción buscada, porque la máquina es determinista.
+  Los cambios y las instantáneas están en anillos de tamaño fijo, así que la memoria no crece con la ejecución:
+  sólo se puede retroceder hasta la instantánea más vieja que sigue en el anillo. Las instantáneas (MEMSIZE
+  palabras cada una) se reservan al tomarlas, no al crear el historial; si no hay memoria para una más, el
+  anillo se queda del tamaño que alcanzó.
 */
-void refreshScreen() {
-  cout << string(80, '\n');
-}
 
-/*
-	Funcion que completa el PC con los ceros requeridos para mostrarlo.
-  Parametros: PC.
-	Valor de retorno: string con el PC completo.
-*/
-string completePC(int iPC) {
- 	string myPC = toString(iPC);
-  ostringstream complete;
+// Registros antes de una instrucción y la celda que escribió con su valor anterior (cell = -1 si no escribió).
+struct HistoryDelta {
+  int PC, PCprev, MAR, cell;
+  Word MDR, IR, AC, old;
+};
+
+// Registros y memoria antes de la instrucción número steps.
+struct HistorySnapshot {
+  long long steps;
+  int PC, PCprev, MAR;
+  Word MDR, IR, AC;
+  Word data[MEMSIZE];
+};
+
+struct History {
+  long long interval;
+  // El cambio de la instrucción k está en deltas[k % deltas.size()]; los guardados son los de [deltaFirst, deltaEnd).
+  vector<HistoryDelta> deltas;
+  long long deltaFirst, deltaEnd;
+  // Instantáneas de la más vieja a la más nueva a partir de snapshotFirst. El anillo crece hasta snapshotCapacity.
+  vector<unique_ptr<HistorySnapshot> > snapshots;
+  size_t snapshotCapacity, snapshotFirst, snapshotCount;
+  // Mientras se ejecuta una instrucción, writeMemory() guarda en su cambio la celda que escribe.
+  bool recording;
+
+  History(long long interval, size_t deltaCount, size_t snapshotCount)
+    : interval(interval), deltas(deltaCount), deltaFirst(0), deltaEnd(0), snapshotCapacity(snapshotCount),
+      snapshotFirst(0), snapshotCount(0), recording(false) {}
+
+  HistoryDelta &delta(long long k) { return deltas[k % deltas.size()]; }
+  HistorySnapshot &snapshot(size_t i) { return *snapshots[(snapshotFirst + i) % snapshots.size()]; }
+};
+
+// Tipos que usa el JIT (motor "jit", sólo en Linux x86-64). Se describe más abajo, junto con el compilador.
+#if defined(__x86_64__) && defined(__linux__)
+
+#define JITBUFSIZE (4 << 20)
+#define JITMAXBLOCK 256
+// Veces que se descarta un bloque por escrituras de STA antes de dejar de traducirlo.
+#define JITMAXINVALIDATIONS 4
+
+// Estado que comparten el despachador y el código nativo. Los desplazamientos JS_* se usan al emitir.
+struct JitState {
+  int32_t ac, mar, mdr, ir, pc, pcPrev;
+  int64_t remaining;
+  void **entries;
+};
+#define JS_AC 0
+#define JS_MAR 4
+#define JS_MDR 8
+#define JS_IR 12
+#define JS_PC 16
+#define JS_PCPREV 20
+#define JS_REMAINING 24
+#define JS_ENTRIES 32
+
+// Un bloque traducido recibe la memoria, el estado y el mapa de celdas protegidas.
+// Regresa 1 si salió antes de una instrucción que debe ejecutar el despachador y 0 en otro caso.
+typedef int (*JitBlock)(int32_t *mem, JitState *st, const uint8_t *codeMap);
+
+struct JitBlockInfo {
+  JitBlock fn;
+  int length;
+  bool tried;
+  int invalidations;
+};
+
+struct JitEmitter;
 
-  for(int i = 0; i < 3 - myPC.length(); i++) {
-  	complete << 0;
-  }
+#endif
 
-  complete << myPC;
-  return complete.str();
-}
+/*
+  Máquina simulada: la memoria, los registros y todo el estado de una ejecución.
+  El menú interactivo trabaja sobre una sola máquina global (sim); el modo por lotes crea una máquina
+  por programa y las ejecuta en paralelo, así que la ejecución no usa ningún estado global
+  (las opciones del menú sólo se leen).
+*/
+class TraceWriter;
+
+class Machine {
+public:
+  // Arreglo de la memoria del simulador.
+  Word data[MEMSIZE];
+  // Instrucciones predecodificadas de cada celda de la memoria.
+  DecodedInst decoded[MEMSIZE];
+  // Valor del PC inicial
+  int PC, PCprev, MAR;
+  // Otros registros
+  Word MDR, AC, IR;
+  // Modo sin menú: no se muestran las microoperaciones y los errores se guardan en vez de imprimirse.
+  bool headlessMode;
+  // Número de instrucciones ejecutadas desde que inició la ejecución.
+  long long steps;
+  // Errores ocurridos durante la ejecución en modo sin menú (se guardan como máximo MAXDIAGNOSTICS).
+  vector<string> diagnostics;
+  long long diagnosticsCount;
+  // Microoperaciones ejecutadas por el motor clásico (cada cambio que muestra displayChanges()).
+  long long microops;
+  // Usar superinstrucciones en los motores rápidos.
+  bool fusionEnabled;
+  // Perfil de la ejecución (vacío si no se está perfilando). Sólo lo llena el motor clásico.
+  unique_ptr<Profile> profile;
+  // Historial para retroceder (vacío si no se guarda). Sólo lo llenan la depuración y su animación.
+  unique_ptr<History> history;
+  // Trazo que se está grabando (NULL si ninguno); writeMemory() y reportError() le avisan lo que pasa en el paso.
+  TraceWriter *trace;
+  // Última celda que escribió STA en el motor clásico y que la animación aún no publica (-1 si ninguna).
+  int lastWrite;
+
+  Machine();
+  Machine(const Machine &other);
+  ~Machine();
+  Machine &operator=(const Machine &) = delete;
+  unique_ptr<Machine> fork(const vector<pair<int, Word> > &cells) const;
+
+  // Índice de las celdas ocupadas y ensamblador guardado de cada celda, para las vistas de la memoria.
+  int nextOccupied(int dir) const;
+  const char *disassemble(int dir);
+  void rebuildIndex();
+
+  // Depuración: puntos de interrupción (direcciones), celdas vigiladas (se detiene cuando cambian)
+  // y valor del AC vigilado. breakReason, breakCell y breakOld dicen por qué se detuvo runToBreak().
+  bool watchAC;
+  Word watchACValue;
+  BreakReason breakReason;
+  int breakCell;
+  Word breakOld;
+  bool isBreakpoint(int dir) const { return breakpoints[dir >> 6] >> (dir & 63) & 1; }
+  bool isWatched(int dir) const { return watchedCells[dir >> 6] >> (dir & 63) & 1; }
+  void toggleBreakpoint(int dir);
+  void toggleWatch(int dir);
+  string runToBreak(bool fromBreak);
+  void recordStep();
+  bool stepBack(long long n);
+  bool animate(long long maxSteps);
+
+  // Memoria y predecodificación.
+  void decodeCell(int dir);
+  void fuseCell(int dir);
+  void decodeMemory();
+  void writeMemory(int dir, Word w);
+  void emptyMemory();
+  bool loadProgram(string_view text, ostream &out);
+  bool loadImage(string_view file, string &error);
+  bool saveImage(string fileName) const;
+  bool loadProgramFile(string fileName, ostream &out);
+  void reportError(string msg);
+
+  // Motor clásico, con la animación de las microoperaciones.
+  void showRegisters(string &out);
+  void showMemoryReg(string &out);
+  void drawFrame();
+  void displayChanges(MicroOpKind kind = MO_REGISTER);
+  template <bool Profiling = false> bool executeStep();
+  void execute();
+  void writeProfile(ostream &out);
+
+  // Modo sin menú.
+  string runHeadless(long long maxSteps, Engine engine);
+  string resume(long long maxSteps, Engine engine);
+  string runCheckpointed(long long maxSteps, Engine engine, string fileName, long long every, bool fromCheckpoint);
+  bool writeCheckpoint(string fileName) const;
+  bool readCheckpoint(string fileName);
+  string runTraced(long long maxSteps, TraceWriter &writer);
+  string runTable(long long maxSteps);
+  string runGoto(long long maxSteps);
+  string runJit(long long maxSteps);
+  void writeAot(ostream &out, string sourceName);
+  void dumpState(ostream &out, string format, string status, string program = "");
+
+private:
+  // Límite de pasos de la ejecución en curso (lo revisan las superinstrucciones).
+  long long stepLimit;
+
+  // occupied: un bit por celda no vacía. disasmValid: un bit por celda cuyo ensamblador en disasmCache
+  // está al día (writeMemory lo borra y disassemble() lo vuelve a calcular sólo cuando se muestra la celda).
+  uint64_t occupied[OCCUPIEDWORDS];
+  uint64_t disasmValid[OCCUPIEDWORDS];
+  char disasmCache[MEMSIZE][FMTBUFSIZE];
+  void indexCell(int dir);
+
+  // Un bit por dirección con punto de interrupción (su manejador es H_BREAK) y por celda vigilada.
+  uint64_t breakpoints[OCCUPIEDWORDS];
+  uint64_t watchedCells[OCCUPIEDWORDS];
+  bool stepOver();
+  string runDebugTable(bool fromBreak, bool replay);
+
+  // Operaciones del motor clásico. Con Profiling = true cuentan las lecturas y escrituras de cada celda;
+  // con false el perfil no genera ningún código.
+  template <bool Profiling> Word readMemory(int dir);
+  template <bool Profiling> void storeMemory(int dir, Word w);
+  template <bool Profiling> string runClassic(long long maxSteps);
+  void opCLA();
+  template <bool Profiling> void opLDA(int iDireccionamiento, int iExtra);
+  template <bool Profiling> void opSTA(int iDireccionamiento, int iExtra);
+  void addToAC(int iValor);
+  template <bool Profiling> void opADD(int iDireccionamiento, int iExtra);
+  template <bool Profiling> void opSUB(int iDireccionamiento, int iExtra);
+  void opNEG();
+  template <bool Profiling> void opJMP(int iDireccionamiento, int iExtra);
+
+  // Manejadores de los motores rápidos y sus auxiliares.
+  // La tabla guarda funciones normales (no apuntadores a miembros, que revisan en cada llamada si son virtuales).
+  typedef bool (*Handler)(Machine &, int);
+  template <bool (Machine::*H)(int)> static bool call(Machine &m, int p) { return (m.*H)(p); }
+  static const Handler handlers[HANDLERCOUNT];
+
+  bool resolveIndirect(int p);
+  bool resolveRelative(int p);
+  void accumulate(int iValor);
+  void nextInSequence();
+  bool hSKIP(int);
+  bool hNOP(int);
+  bool hCLA(int);
+  bool hLDA_ABS(int p);
+  bool hLDA_IND(int p);
+  bool hLDA_INM(int p);
+  bool hLDA_REL(int p);
+  bool hSTA_ABS(int p);
+  bool hSTA_IND(int p);
+  bool hSTA_REL(int p);
+  bool hADD_ABS(int p);
+  bool hADD_IND(int p);
+  bool hADD_INM(int p);
+  bool hADD_REL(int p);
+  bool hSUB_ABS(int p);
+  bool hSUB_IND(int p);
+  bool hSUB_INM(int p);
+  bool hSUB_REL(int p);
+  bool hNEG(int);
+  bool hJMP_ABS(int p);
+  bool hJMP_IND(int p);
+  bool hJMP_REL(int p);
+  bool hHLT(int);
+  bool hINVALID(int);
+  bool hJMP_INVALID(int);
+  bool hBREAK(int);
+  bool hLDA_ADD_STA(int p);
+  bool hLDA_SUB_STA(int p);
+  bool hLDA_ADDI_STA(int p);
+  bool hCLA_ADDI(int p);
+
+#if defined(__x86_64__) && defined(__linux__)
+  uint8_t *jitBuffer;
+  size_t jitUsed;
+  JitBlockInfo jitBlocks[MEMSIZE];
+  // Punto de entrada de cada bloque para saltar desde otro bloque (con el acumulador ya en r8d).
+  void *jitEntries[MEMSIZE];
+  // jitCovered: número de bloques traducidos que incluyen la celda.
+  // jitCodeMap: STA en esa celda debe hacerlo el despachador (está traducida o contiene una instrucción).
+  uint16_t jitCovered[MEMSIZE];
+  uint8_t jitCodeMap[MEMSIZE];
+
+  bool jitInit();
+  void jitFlush();
+  void jitInvalidate(int dir);
+  void jitEmitEnd(JitEmitter &e, const vector<int> &addrs, int t);
+  void jitEmitEndIndirect(JitEmitter &e, const vector<int> &addrs);
+  void jitTranslate(int start);
+#endif
+};
 
-// Función que convierte de maquinal a ensamblador.
-// Parámetros: string con la instrucción en maquinal.
-// Valor de retorno: string con la instrucción en esamblador.
-string convertAssemb(string inst) {
+// Máquina del menú interactivo.
+Machine sim;
 
-  string opCode = inst.substr(0,2), code;
-  char addrType = inst[2];
-  string addr;
-  string parameter = inst.substr(3);
+/*
+  Cola circular para un solo productor y un solo consumidor, sin candados: el productor sólo escribe tail
+  y el consumidor sólo escribe head (en líneas de caché distintas), y cada uno publica su avance con
+  memory_order_release después de escribir o leer el elemento. push y pop nunca esperan: regresan false
+  si la cola está llena o vacía.
+*/
+template <class T, size_t N>
+class SpscRing {
+  static_assert((N & (N - 1)) == 0, "el tamaño de la cola debe ser potencia de 2");
+
+public:
+  SpscRing() : head(0), tail(0) {}
+
+  bool push(const T &item) {
+    size_t t = tail.load(memory_order_relaxed);
+    if (t - head.load(memory_order_acquire) == N)
+      return false;
+    items[t & (N - 1)] = item;
+    tail.store(t + 1, memory_order_release);
+    return true;
+  }
 
-  code = codes[atoi(opCode.c_str())];
+  bool pop(T &item) {
+    size_t h = head.load(memory_order_relaxed);
+    if (h == tail.load(memory_order_acquire))
+      return false;
+    item = items[h & (N - 1)];
+    head.store(h + 1, memory_order_release);
+    return true;
+  }
 
-  switch(addrType) {
-  	case '1':
-    	addr = "ABS";
-    	break;
-    case '2':
-    	addr = "IND";
-    	break;
-    case '3':
-    	addr = "INM";
-    	break;
-    case '4':
-    	addr = "REL";
-    	break;
+  // Regresa true si la cola tiene lugar para n elementos (sólo lo llama el productor).
+  bool hasRoom(size_t n) const {
+    return tail.load(memory_order_relaxed) - head.load(memory_order_acquire) + n <= N;
   }
 
-  if(code == "NOP" || code == "CLA" || code == "NEG" || code == "HLT")
-    parameter = "";
+private:
+  alignas(64) atomic<size_t> head;
+  alignas(64) atomic<size_t> tail;
+  T items[N];
+};
 
-  return code + " " + addr + " " + parameter;;
-}
+/*
+  Animación asíncrona de las microoperaciones.
+
+  execute() arranca un hilo que dibuja la animación sobre su propia copia de la máquina (view). Cada
+  microoperación publica en la cola los registros y, si STA escribió una celda, la celda; el hilo aplica
+  los cambios a su copia y dibuja una imagen cuando ScreenRenderer lo permite, así que si se atrasa junta
+  varias microoperaciones en una imagen. La ejecución nunca espera a la terminal: si la cola está llena,
+  las celdas escritas se guardan como pendientes (cada celda una vez, con su último valor) y los registros
+  se descartan, porque la siguiente microoperación publica los suyos. Sólo al terminar se espera a que el
+  hilo dibuje la última imagen. Los mensajes de error también pasan por la cola para salir en orden.
+*/
+#define RENDERRING 1024
+#define RENDERMSGSIZE 32
+
+enum RenderEventKind { RE_REGISTERS, RE_WRITE, RE_MESSAGE, RE_END };
+
+struct RenderEvent {
+  uint8_t kind;
+  // RE_REGISTERS.
+  int PC, PCprev, MAR;
+  Word MDR, IR, AC;
+  // RE_WRITE.
+  int cell;
+  Word word;
+  // RE_MESSAGE.
+  char message[RENDERMSGSIZE];
+};
+
+class AnimationRenderer {
+public:
+  AnimationRenderer() : running(false) {}
+  bool isRunning() const { return running; }
+  void start(const Machine &machine);
+  void publish(Machine &machine);
+  void message(const string &msg);
+  void finish(const Machine &machine);
+
+private:
+  bool flushWrites(const Machine &machine);
+  void pushWait(const RenderEvent &event);
+  void run();
+
+  SpscRing<RenderEvent, RENDERRING> ring;
+  unique_ptr<Machine> view;
+  thread worker;
+  bool running;
+  // Celdas escritas que no cupieron en la cola.
+  bool dirty[MEMSIZE];
+  vector<int> dirtyCells;
+};
+
+// Animación de la máquina del menú.
+AnimationRenderer animation;
 
 /*
-  Funcion que muestra las direcciones de memoria, su contenido y la dirección ejecutándose actualmente.
-  Parámetros: ninguno.
-  Valor de retorno: ninguno.
+  Grabador del trazo binario de la ejecución (se describe junto a runTraced()). Guarda los bytes en un buffer
+  grande y lo escribe al archivo cuando se llena.
 */
-void showMemoryReg() {
-	int iSpaces;
-  for(int i = 0; i < MEMSIZE; i++) {
-    if (data[i] != "") {
-      if(data[i][0] != '+' && data[i][0] != '-') {
-        cout << setw(3) << setfill('0') << i << "\t" << data[i];
+#define TRACEBUFSIZE (1 << 20)
+
+class TraceWriter {
+public:
+  TraceWriter() : written(false), file(NULL), used(0), failed(false) {}
+  ~TraceWriter() { close(); }
+  bool open(string fileName, const Machine &machine);
+  void step(const Machine &machine, int pcBefore);
+  bool close(string status = "");
+
+  // Lo que pasó en el paso que se está ejecutando (lo avisan writeMemory() y reportError()).
+  bool written;
+  vector<string> errors;
+
+private:
+  void putByte(uint8_t byte) { buffer[used++] = byte; }
+  void putVarint(uint64_t value);
+  void putSigned(int64_t value) { putVarint(((uint64_t) value << 1) ^ (uint64_t) (value >> 63)); }
+  void putText(const string &text);
+  void flush();
+
+  FILE *file;
+  unique_ptr<uint8_t[]> buffer;
+  size_t used;
+  bool failed;
+  int PCprev, MAR;
+  Word MDR, AC;
+};
 
-        iSpaces = 15 - convertAssemb(data[i]).length();
 
-        cout << "  " << convertAssemb(data[i]);
-        if(i == PCprev)
-          cout << setw(iSpaces) << setfill(' ') << "<==";
-        cout << endl;
-      } else {
-      	cout << setw(3) << setfill('0') << i << "\t" << data[i];
-    		cout << endl;
-      }
-    }
+/*
+  Ensamblador: lo comparten la carga de archivos (del menú, sin menú y por lotes) y la edición de la memoria.
+  Trabaja sobre string_view (el archivo proyectado con mmap o lo leído de la entrada estándar) sin copiar
+  las líneas ni crear flujos, y reporta todos los errores del programa en una sola pasada.
+
+  Las operaciones y los tipos de direccionamiento son palabras de tres letras; se buscan en una tabla de
+  ASMHASHSIZE entradas con el hash perfecto (2 * c0 + 21 * c1 + c2) % 32, que no tiene colisiones entre las
+  13 palabras, y una sola comparación confirma la palabra (mayúsculas o minúsculas).
+*/
+#define ASMHASHSIZE 32
+
+// Resultado de ensamblar una línea. Los errores van al final, después de ASM_DATA.
+enum AsmResult {
+  ASM_EMPTY, ASM_NOPARAM, ASM_INSTRUCTION, ASM_DATA,
+  ASM_ERR_OPERATION, ASM_ERR_ADDRTYPE, ASM_ERR_PARAM, ASM_ERR_SIGNED
+};
+
+// Mensajes de los errores del ensamblador, en el orden de AsmResult a partir de ASM_ERR_OPERATION.
+const char *asmErrors[] = {
+  "no se encontró una operación o valor/dato válido.",
+  "no se encontró un tipo de direccionamiento válido.",
+  "no se encontró un valor de parámetro válido.",
+  "El parámetro no puede tener signo para ese tipo de direccionamiento."
+};
+
+// Palabra clave del ensamblador: una operación (addrType = -1) o un tipo de direccionamiento (opCode = -1).
+struct AsmKeyword {
+  char name[4];
+  int8_t opCode;
+  int8_t addrType;
+};
+
+// Función que calcula el hash perfecto de una palabra de tres letras mayúsculas.
+// Parámetro: las tres letras.
+// Valor de retorno: la entrada de la tabla de palabras clave.
+inline int asmHash(const char *name) {
+  return (name[0] * 2 + name[1] * 21 + name[2]) & (ASMHASHSIZE - 1);
+}
+
+// Función que construye la tabla de palabras clave a partir de codes[] y los tipos de direccionamiento.
+// Se llama una sola vez, al inicializar la tabla de findKeyword (también desde los hilos del modo por lotes).
+// Parámetros: ninguno.
+// Valor de retorno: la tabla (las entradas libres tienen el nombre vacío).
+const AsmKeyword *buildKeywordTable() {
+  static AsmKeyword table[ASMHASHSIZE];
+  static const char *addrNames[] = {"ABS", "IND", "INM", "REL"};
+  for (int i = 0; i < 9; i++) {
+    AsmKeyword &k = table[asmHash(codes[i].c_str())];
+    memcpy(k.name, codes[i].c_str(), 4);
+    k.opCode = i;
+    k.addrType = -1;
   }
-  cout << endl;
+  for (int i = 0; i < 4; i++) {
+    AsmKeyword &k = table[asmHash(addrNames[i])];
+    memcpy(k.name, addrNames[i], 4);
+    k.opCode = -1;
+    k.addrType = i + 1;
+  }
+  return table;
 }
 
-/*
-	Funcion que muestra en pantalla los registros y sus cambios
-  Parametros: ninguno.
-  valor de retorno: ninguno.
-*/
-void displayChanges() {
-  WAIT(secs * CONV);
-  refreshScreen();
+// Función que busca una palabra clave del ensamblador.
+// Parámetro: el texto de la palabra.
+// Valor de retorno: la palabra clave, o NULL si el texto no es una.
+const AsmKeyword *findKeyword(string_view word) {
+  static const AsmKeyword *table = buildKeywordTable();
+  if (word.size() != 3)
+    return NULL;
+  char name[3];
+  for (int i = 0; i < 3; i++)
+    name[i] = word[i] >= 'a' && word[i] <= 'z' ? word[i] - 'a' + 'A' : word[i];
+  const AsmKeyword &k = table[asmHash(name)];
+  return memcmp(k.name, name, 3) == 0 ? &k : NULL;
+}
 
-  cout << "\t\tR E G I S T R O S" << endl << endl;
-	cout << setfill(' ') << setw(5) << "|"  << setw(5) << "PC" << setw(4) << "|" << setw(6) << "MAR" << setw(4) << "|"  << setw(6) << "MDR" << setw(4) << "|"  << setw(5) << "IR" << setw(4) << "|" << endl;
-  cout << setw(10) << completePC(PC) << " " << setw(9) << MAR << " " << setw(10) << MDR << " " << setw(9) << IR << endl << endl;
-  cout << setw(11) << "AC" << ": " << setw(8) << AC << endl;
+// Función que revisa si un caracter es un dígito (sin depender del locale ni del signo de char).
+inline bool isAsmDigit(char c) {
+  return c >= '0' && c <= '9';
+}
 
-  cout << endl;
-  showMemoryReg();
+// Función que revisa si un caracter separa las partes de una línea (los mismos espacios que usa >>).
+inline bool isAsmSpace(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
 }
 
-// Función que regresa un string que contiene cómo se mostrará la opción de acuerdo con su estado (activado/desactivado).
-// Parámetros: una variable booleana.
-// Valor de retorno: un string que contiene cómo se mostrará la opción.
-string getBoolX(bool var) {
-    if(var)
-        return "[X]";
-    else
-        return "[ ]";
+// Función que toma la siguiente parte de una línea separada por espacios.
+// Parámetros: la línea y la posición desde donde se busca (se avanza hasta después de la parte).
+// Valor de retorno: la parte (vacía si ya no hay).
+string_view nextToken(string_view line, size_t &pos) {
+  while (pos < line.size() && isAsmSpace(line[pos]))
+    pos++;
+  size_t start = pos;
+  while (pos < line.size() && !isAsmSpace(line[pos]))
+    pos++;
+  return line.substr(start, pos - start);
 }
 
 /*
-  Funcion que muestra las direcciones de memoria y su contenido.
-  Parámetros: ninguno.
-  Valor de retorno: ninguno.
+  Función que ensambla una línea: vacía, una operación sin parámetros (HLT, NEG, CLA, NOP), una operación
+  con su tipo de direccionamiento y un parámetro de ADDRDIGITS caracteres (por ejemplo, LDA ABS 003 o
+  ADD INM -05) o un dato con signo y WORDDIGITS dígitos (por ejemplo, +00012).
+  Parámetros: la línea y la palabra donde se guarda el resultado (sólo cambia si no hay error).
+  Valor de retorno: qué se encontró en la línea o el error (a partir de ASM_ERR_OPERATION).
 */
-void showMemory() {
-  if(showWholeMemory) {
-    for(int i = 0; i < 10; i++) {
-        cout << "\t" << setw(2) << setfill('0') << i;
-    }
+AsmResult assembleLine(string_view line, Word &w) {
+  if (line.empty()) {
+    w = Word::empty();
+    return ASM_EMPTY;
+  }
 
-    cout << endl;
+  size_t pos = 0;
+  const AsmKeyword *op = findKeyword(nextToken(line, pos));
 
-    for(int i = 0; i < MEMSIZE; i += 10) {
-        cout << setw(3) << setfill('0') << i;
+  if (op != NULL && op->opCode >= 0) {
+    int opCode = op->opCode;
+    if (opCode == 0 || opCode == 1 || opCode == 6 || opCode == 8) {
+      w = Word::instruction(opCode, 0, 0, 0);
+      return ASM_NOPARAM;
+    }
 
-        for(int j = i; j < i + 10; j++) {
-                cout << "\t" << data[j];
-        }
-        cout << endl;
+    const AsmKeyword *addr = findKeyword(nextToken(line, pos));
+    if (addr == NULL || addr->addrType < 0)
+      return ASM_ERR_ADDRTYPE;
+
+    string_view param = nextToken(line, pos);
+    if (param.size() != ADDRDIGITS || !(isAsmDigit(param[0]) || param[0] == '+' || param[0] == '-'))
+      return ASM_ERR_PARAM;
+    int sign = param[0] == '+' ? 1 : param[0] == '-' ? 2 : 0;
+    int mag = sign != 0 ? 0 : param[0] - '0';
+    for (int i = 1; i < ADDRDIGITS; i++) {
+      if (!isAsmDigit(param[i]))
+        return ASM_ERR_PARAM;
+      mag = mag * 10 + (param[i] - '0');
     }
 
-    cout << endl << endl;
+    if (sign != 0 && (addr->addrType == 1 || addr->addrType == 2))
+      return ASM_ERR_SIGNED;
+
+    w = Word::instruction(opCode, addr->addrType, sign, mag);
+    return ASM_INSTRUCTION;
   }
-  else {
-    cout << "Se muestran solo las direcciones de memoria no vacias:" << endl << endl;
-    for(int i = 0; i < MEMSIZE; i++) {
-      if (data[i] != "") {
-        if(data[i][0] != '+' && data[i][0] != '-') {
-              cout << setw(3) << setfill('0') << i << "\t" << data[i] << "  " << convertAssemb(data[i]) << endl;
-        }
-        else {
-         cout << setw(3) << setfill('0') << i << "\t" << data[i] << endl;
-        }
-      }
+
+  // Si no es una operación, debe ser un dato: el signo y WORDDIGITS dígitos, sin nada más en la línea.
+  if ((line[0] == '+' || line[0] == '-') && line.size() == Format::dataChars) {
+    int value = 0;
+    for (int i = 1; i < Format::dataChars; i++) {
+      if (!isAsmDigit(line[i]))
+        return ASM_ERR_OPERATION;
+      value = value * 10 + (line[i] - '0');
     }
+    w = Word::fromValue(line[0] == '-' ? -value : value);
+    return ASM_DATA;
   }
 
-  cout << endl;
+  return ASM_ERR_OPERATION;
 }
 
-
 /*
-  Función que edita el contenido de una dirección de memoria directamente.
-  Parámetros: ninguno.
-  Valor de retorno: ninguno.
+  Formato sin reservar memoria: formatNumber, formatAddress, formatWord y formatAssembly escriben en un
+  arreglo del llamador (normalmente en la pila, de FMTBUFSIZE caracteres) y regresan el texto terminado en '\0'.
+  Las usan la pantalla de la animación, el menú, el volcado del estado y el ensamblador. toString, completePC
+  y convertAssemb regresan el mismo texto como string; son textos cortos, que string guarda sin reservar memoria.
+  appendNumber y appendPadded agregan texto a un string que se reutiliza (su capacidad no se libera).
 */
-void editMemoryDirectly() {
-  int dir;
-  string val;
-
-  cout << "Introduzca la direccion de memoria por modificar: ";
-  cin >> dir;
-
-  cout << "La dirección " << setw(3) << setfill('0') << dir << " contiene: ";
-  if(data[dir] == "")
-      cout << "(vacío)";
-  else
-      cout << data[dir] << "   (" << convertAssemb(data[dir]) << ")";
-  cout << endl;
 
-  cout << "Introduzca el nuevo valor: ";
-  cin >> val;
-  cout << endl;
+// Función que escribe un número en decimal.
+// Parámetros: el número y el arreglo.
+// Valor de retorno: el arreglo.
+char *formatNumber(long long num, char *buf) {
+  *to_chars(buf, buf + FMTBUFSIZE - 1, num).ptr = '\0';
+  return buf;
+}
 
-  // Validation process starts here.
+// Función que agrega un número en decimal a un string.
+// Parámetros: el string y el número.
+// Valor de retorno: ninguno.
+void appendNumber(string &out, long long num) {
+  char buf[FMTBUFSIZE];
+  out.append(buf, to_chars(buf, buf + FMTBUFSIZE, num).ptr - buf);
+}
 
-  // If it's data/value...
-  if(val[0] == '+' || val[0] == '-') {
-  	data[dir] = val;
-  } else {
-  	// If it's an instruction...
-    string opCode, addr, param;
-    int iOpCode, iAddr;
+// Función que agrega un texto a un string, alineado a la derecha en un ancho (como setw).
+// Parámetros: el string, el texto y el ancho.
+// Valor de retorno: ninguno.
+void appendPadded(string &out, const char *text, int width) {
+  int len = strlen(text);
+  if (len < width)
+    out.append(width - len, ' ');
+  out.append(text, len);
+}
 
-    opCode = val.substr(0, 2);
-    iOpCode = atoi(opCode.c_str());
-    // If it's a valid operation code...
-    if(iOpCode >= 0 && iOpCode < 9) {
-    	addr = val.substr(2, 1);
-		iAddr = atoi(addr.c_str());
+// Función que convierte un entero a un string.
+// Parámetro: el número entero.
+// Valor de retorno: string con el entero convertido.
+string toString(long long num) {
+  char buf[FMTBUFSIZE];
+  return formatNumber(num, buf);
+}
 
-      // If it's an instruction which doesn't take parameters, set addressing type to 1 to make it valid.
-      if(iOpCode == 0 || iOpCode == 1 || iOpCode == 6 || iOpCode == 8)
-        iAddr = 1;
+// Función que escapa las comillas y diagonales invertidas de un texto para escribirlo en JSON.
+// Parámetro: el texto.
+// Valor de retorno: el texto escapado.
+string jsonEscape(string text) {
+  string escaped;
+  for(size_t i = 0; i < text.length(); i++) {
+    if(text[i] == '"' || text[i] == '\\')
+      escaped += '\\';
+    escaped += text[i];
+  }
+  return escaped;
+}
 
-      // If it's a valid addressing type...
-      if(iAddr >= 1 && iAddr <= 4) {
-    		param = val.substr(3);
+// Función que escribe el texto de una palabra (por ejemplo: "+00012" o "041006") en un buffer.
+// Parámetros: la palabra y un buffer de FMTBUFSIZE caracteres.
+// Valor de retorno: ninguno.
+void formatWord(Word w, char *buf) {
+  if(w.isEmpty()) {
+    buf[0] = '\0';
+  } else if(w.isData()) {
+    int v = w.bits < 0 ? -w.bits : w.bits;
+    buf[0] = w.bits < 0 ? '-' : '+';
+    for(int i = WORDDIGITS; i >= 1; i--, v /= 10)
+      buf[i] = '0' + v % 10;
+    buf[WORDDIGITS + 1] = '\0';
+  } else {
+    int mag = w.paramMag();
+    buf[0] = '0' + w.opCode() / 10;
+    buf[1] = '0' + w.opCode() % 10;
+    buf[2] = '0' + w.addrType();
+    for(int i = ADDRDIGITS + 2; i >= 3; i--, mag /= 10)
+      buf[i] = '0' + mag % 10;
+    // Un parámetro con signo tiene un dígito menos.
+    if(w.paramSign() != 0)
+      buf[3] = w.paramSign() == 1 ? '+' : '-';
+    buf[ADDRDIGITS + 3] = '\0';
+  }
+}
 
-        // If parameter is three characters long...
-        if(param.length() == 3) {
+ostream &operator<<(ostream &out, Word w) {
+  char buf[FMTBUFSIZE];
+  formatWord(w, buf);
+  return out << buf;
+}
 
-          // If addressing type is ABS or IND...
-          if(iAddr == 1 || iAddr == 2) {
-            if(param[0] == '+'  || param[0] == '-') {
-              cout << "  ERROR: El parámetro no puede tener signo para ese tipo de direccionamiento." << endl;
-              return;
-            }
-          }
+// Función que convierte el texto de una palabra a su forma empacada.
+// Acepta "" (vacía), un dato con signo y hasta WORDDIGITS dígitos, o una instrucción de ADDRDIGITS + 3
+// caracteres cuyo parámetro son ADDRDIGITS dígitos o un signo y un dígito menos (en la máquina clásica, un dato
+// de hasta cinco dígitos o una instrucción de seis caracteres).
+// Parámetros: el texto y la palabra donde se guarda el resultado.
+// Valor de retorno: true si el texto es una palabra válida.
+bool parseWord(string text, Word &w) {
+  int n = text.length();
+
+  if(n == 0) {
+    w = Word::empty();
+    return true;
+  }
 
-			// Success. Save to memory.
-        	data[dir] = val;
-  				cout << "Dirección de memoria modificada exitosamente.";
-        } else {
-        	cout << "ERROR: el parámetro debe ser de tres caracteres.";
-        }
-      } else {
-        cout << "ERROR: el tipo de direccionamiento no es válido.";
-      }
-    } else {
-    	cout << "ERROR: el código de operación no es válido.";
+  if(text[0] == '+' || text[0] == '-') {
+    if(n < 2 || n > Format::dataChars)
+      return false;
+    int value = 0;
+    for(int i = 1; i < n; i++) {
+      if(!isdigit(text[i]))
+        return false;
+      value = value * 10 + (text[i] - '0');
     }
-
+    w = Word::fromValue(text[0] == '-' ? -value : value);
+    return true;
   }
-   cout << endl;
-}
 
-/*
-  Función que edita el contenido de una dirección de memoria con la instrucción dada.
-  Parámetros: ninguno.
-  Valor de retorno: ninguno.
-*/
-void editMemory() {
-  int dir;
-  string line;
+  if(n != Format::instChars || !isdigit(text[0]) || !isdigit(text[1]) || !isdigit(text[2]))
+    return false;
 
-  cout << "Introduzca la dirección de memoria por modificar: ";
-  cin >> dir;
-  cin.ignore();
+  int opCode = (text[0] - '0') * 10 + (text[1] - '0');
+  if(opCode > 8)
+    return false;
 
-  cout << "La dirección " << setw(3) << setfill('0') << dir << " contiene: ";
-  if(data[dir] == "")
-      cout << "(vacío)";
+  int sign = 0, mag = 0;
+  if(text[3] == '+')
+    sign = 1;
+  else if(text[3] == '-')
+    sign = 2;
+  else if(isdigit(text[3]))
+    mag = text[3] - '0';
   else
-      cout << data[dir] << "   (" << convertAssemb(data[dir]) << ")";
-  cout << endl;
+    return false;
+  for(int i = 4; i < n; i++) {
+    if(!isdigit(text[i]))
+      return false;
+    mag = mag * 10 + (text[i] - '0');
+  }
 
-  cout << "Introduzca el nuevo contenido en ensamblador (por ejemplo, LDA ABS 003): ";
-  getline(cin, line);
-  line = toUpper(line);
+  w = Word::instruction(opCode, text[2] - '0', sign, mag);
+  return true;
+}
+
+// Función que revisa si una palabra empacada que viene de un archivo binario (imagen o punto de control)
+// es una que el ensamblador puede producir: vacía, un dato, o una instrucción con código de operación de
+// 0 a 8, tipo de direccionamiento de un dígito y un parámetro dentro de la memoria (sin signo en los
+// direccionamientos absoluto e indirecto, que lo usan directamente como dirección).
+// Parámetro: la palabra.
+// Valor de retorno: true si es válida.
+bool isValidWord(Word w) {
+  if(w.isEmpty() || w.isData())
+    return true;
+  if(!w.isInstruction() || w.bits > (WORD_INST | ((1 << Format::instBits) - 1)))
+    return false;
+  int maxMag = w.paramSign() == 0 ? Format::maxParam : powerOf10(ADDRDIGITS - 1) - 1;
+  if(w.paramSign() != 0 && (w.addrType() == 1 || w.addrType() == 2))
+    return false;
+  return w.opCode() <= 8 && w.addrType() <= 9 && w.paramSign() != 3 && w.paramMag() <= maxMag;
+}
 
-  // "Compiling" process starts here.
+// Función que obtiene el manejador de los motores rápidos para una instrucción.
+// Parámetros: el código de operación y el tipo de direccionamiento.
+// Valor de retorno: el identificador del manejador.
+int getHandler(int opCode, int addrType) {
+  switch(opCode) {
+    case 0: return H_NOP;
+    case 1: return H_CLA;
+    case 6: return H_NEG;
+    case 8: return H_HLT;
+    case 7:
+      if(addrType == 1) return H_JMP_ABS;
+      if(addrType == 2) return H_JMP_IND;
+      if(addrType == 4) return H_JMP_REL;
+      return H_JMP_INVALID;
+    default:
+      // Los manejadores de cada operación con parámetro siguen el orden ABS, IND, INM, REL.
+      if(addrType < 1 || addrType > 4)
+        return H_INVALID;
+      if(opCode == 2) return H_LDA_ABS + addrType - 1;
+      if(opCode == 3) return addrType == 3 ? H_INVALID : addrType == 4 ? H_STA_REL : H_STA_ABS + addrType - 1;
+      if(opCode == 4) return H_ADD_ABS + addrType - 1;
+      return H_SUB_ABS + addrType - 1;
+  }
+}
 
-  // ints to store operation code, addressing type and parameter value. They will be merged to form an instruction.
-  int opCode, addrType;
-  string segment, param;
+// Función que predecodifica una palabra (sin superinstrucciones).
+// Parámetro: la palabra.
+// Valor de retorno: la instrucción predecodificada (opCode = NOTINST si la palabra no es una instrucción).
+DecodedInst decodeWord(Word w) {
+  DecodedInst d;
+  if(w.isInstruction()) {
+    d.opCode = w.opCode();
+    d.addrType = w.addrType();
+    d.param = w.param();
+    d.handler = getHandler(w.opCode(), w.addrType());
+  } else {
+    d.opCode = NOTINST;
+    d.addrType = 0;
+    d.handler = H_SKIP;
+    d.param = 0;
+  }
+  return d;
+}
 
-      // If the line is empty, store as empty string("").
-      if(line.empty()) {
-          data[dir] = "";
-      } else {
-          istringstream inStream(line);
-          ostringstream outStream;
+// Función que predecodifica el contenido de una celda de memoria.
+// Parámetro: la dirección de la celda.
+// Valor de retorno: ninguno.
+void Machine::decodeCell(int dir) {
+  decoded[dir] = decodeWord(data[dir]);
+}
 
-          // This should contain the operation (e.g. "LDA" or "CLA").
-          inStream >> segment;
-          opCode = getOpCode(segment);
+// Función que revisa si una celda empieza una secuencia que se ejecuta como superinstrucción
+// y ajusta su manejador (el de la superinstrucción o el de la instrucción sola).
+// Parámetro: la dirección de la celda.
+// Valor de retorno: ninguno.
+void Machine::fuseCell(int dir) {
+  if(dir < 0 || dir >= MEMSIZE)
+    return;
+
+  // Un punto de interrupción reemplaza al manejador, también en las celdas sin instrucción.
+  if(isBreakpoint(dir)) {
+    decoded[dir].handler = H_BREAK;
+    return;
+  }
+  if(decoded[dir].opCode == NOTINST) {
+    decoded[dir].handler = H_SKIP;
+    return;
+  }
 
-          // If operation is an instruction which doesn't take parameters...
-          if(codes[opCode] == "HLT" || codes[opCode] == "NEG" || codes[opCode] == "CLA" || codes[opCode] == "NOP") {
-                  outStream << setw(2) << setfill('0') << opCode;
-                  outStream << "0000";
-                  data[dir] = outStream.str();
+  DecodedInst &first = decoded[dir];
+  first.handler = getHandler(first.opCode, first.addrType);
 
-            			cout << data[dir] << endl << endl;
+  // Una superinstrucción no puede saltarse un punto de interrupción.
+  if(!fusionEnabled || dir + 1 >= MEMSIZE || isBreakpoint(dir + 1))
+    return;
 
-            // If operation code is valid...
-          } else if(opCode != -1) {
+  const DecodedInst &second = decoded[dir + 1];
 
-              // This should contain the addressing type (e.g. "ABS" or "INM").
-              inStream >> segment;
-              addrType = getAddrType(segment);
+  if(first.handler == H_CLA && second.opCode == 4 && second.addrType == 3) {
+    first.handler = F_CLA_ADDI;
+    return;
+  }
 
-            	// If the addressing type is valid...
-              if(addrType != -1) {
+  if(first.handler != H_LDA_ABS || dir + 2 >= MEMSIZE || isBreakpoint(dir + 2))
+    return;
 
-                  // This should contain the parameter value, a three digit number (e.g. "020" or "123").
-                  inStream >> segment;
+  const DecodedInst &third = decoded[dir + 2];
+  if(third.opCode != 3 || third.addrType != 1)
+    return;
 
-                  if(segment.length() == 3) {
+  if(second.opCode == 4 && second.addrType == 1)
+    first.handler = F_LDA_ADD_STA;
+  else if(second.opCode == 5 && second.addrType == 1)
+    first.handler = F_LDA_SUB_STA;
+  else if(second.opCode == 4 && second.addrType == 3)
+    first.handler = F_LDA_ADDI_STA;
+}
 
-                    	// If addressing type is ABS or IND...
-                      if(addrType == 1 || addrType == 2) {
-                        if(segment[0] == '+'  || segment[0] == '-') {
-                        	cout << "ERROR: El parámetro no puede tener signo para ese tipo de direccionamiento." << endl;
-                          return;
-                        }
-                      }
+// Función que predecodifica toda la memoria (después de cargar o vaciar).
+// Parámetros: ninguno.
+// Valor de retorno: ninguno.
+void Machine::decodeMemory() {
+  for(int i = 0; i < MEMSIZE; i++)
+    decodeCell(i);
+  for(int i = 0; i < MEMSIZE; i++)
+    fuseCell(i);
+  rebuildIndex();
+}
 
-                      param = segment;
+// Función que marca si una celda está ocupada y descarta su ensamblador guardado.
+// Parámetro: la dirección de la celda.
+// Valor de retorno: ninguno.
+inline void Machine::indexCell(int dir) {
+  uint64_t bit = 1ULL << (dir & 63);
+  if(data[dir].isEmpty())
+    occupied[dir >> 6] &= ~bit;
+  else
+    occupied[dir >> 6] |= bit;
+  disasmValid[dir >> 6] &= ~bit;
+}
 
-                      outStream << setw(2) << setfill('0') << opCode;
-                      outStream << addrType;
-                      outStream << param;
+// Función que reconstruye el índice de celdas ocupadas, después de escribir en data sin writeMemory()
+// (al cargar un archivo o al terminar el JIT, que escribe directamente en la memoria).
+// Parámetros: ninguno.
+// Valor de retorno: ninguno.
+void Machine::rebuildIndex() {
+  memset(occupied, 0, sizeof occupied);
+  memset(disasmValid, 0, sizeof disasmValid);
+  for(int i = 0; i < MEMSIZE; i++) {
+    if(!data[i].isEmpty())
+      occupied[i >> 6] |= 1ULL << (i & 63);
+  }
+}
 
-                      data[dir] = outStream.str();
-                      cout << data[dir] << endl << endl;
+// Función que busca la siguiente celda ocupada, para recorrer la memoria así:
+//   for(int i = nextOccupied(0); i < MEMSIZE; i = nextOccupied(i + 1))
+// Parámetro: la dirección desde donde se busca.
+// Valor de retorno: la dirección de la celda ocupada (MEMSIZE si ya no hay).
+int Machine::nextOccupied(int dir) const {
+  if(dir >= MEMSIZE)
+    return MEMSIZE;
+  int k = dir >> 6;
+  uint64_t bits = occupied[k] & (~0ULL << (dir & 63));
+  while(bits == 0) {
+    if(++k == OCCUPIEDWORDS)
+      return MEMSIZE;
+    bits = occupied[k];
+  }
+#if defined(__GNUC__) || defined(__clang__)
+  int low = __builtin_ctzll(bits);
+#else
+  int low = 0;
+  while(!(bits >> low & 1))
+    low++;
+#endif
+  return k * 64 + low;
+}
 
-                  } else {
-                      cout << "ERROR: no se encontró un valor de parámetro válido." << endl;
-                      return;
-                  }
-              } else {
-                  cout << "ERROR: no se encontró un tipo de direccionamiento válido." << endl;
-                  return;
-              }
 
-          // If operation code is invalid but it's a value (values start with the sign and must be six characters long)...
-          } else if( (line[0] == '+' || line[0] == '-') &&  line.length() == 6 ) {
-              data[dir] = line;
-            	cout << data[dir] << endl << endl;
+// Función que escribe una palabra en la memoria y actualiza su instrucción predecodificada.
+// Parámetros: la dirección y la palabra por escribir.
+// Valor de retorno: ninguno.
+void Machine::writeMemory(int dir, Word w) {
+  // Una celda vigilada que cambia detiene los motores rápidos en el siguiente despacho.
+  if(isWatched(dir) && data[dir] != w) {
+    breakReason = BREAK_WATCH;
+    breakCell = dir;
+    breakOld = data[dir];
+    stepLimit = steps;
+  }
+  if(trace)
+    trace->written = true;
+  if(history && history->recording) {
+    HistoryDelta &d = history->delta(history->deltaEnd - 1);
+    d.cell = dir;
+    d.old = data[dir];
+  }
+  data[dir] = w;
+  indexCell(dir);
 
-          // If operation code is invalid and it's not a value...
-          } else {
-              cout << "ERROR: no se encontró una operación o valor/dato válido." << endl;
-              return;
-          }
-      }
+  // Si la celda no tenía ni tendrá una instrucción, su predecodificación no cambia.
+  if(decoded[dir].opCode == NOTINST && !w.isInstruction())
+    return;
 
-  	cout << endl << "Dirección de memoria modificada exitosamente." << endl;
+  decodeCell(dir);
+  // Una superinstrucción que incluya esta celda empieza a lo más dos celdas antes.
+  for(int i = dir - 2; i <= dir; i++)
+    fuseCell(i);
 }
 
-/*
-  Función que carga la memoria del simulador con los datos de un archivo.
-  Parámetros: ninguno.
-  Valor de retorno: ninguno.
-*/
-void loadFile() {
-  ifstream file;
-  string line, segment, fileName;
-  bool compileSuccess = true;
-
-  cin.ignore();
-  cout << "Se sobreescribirán las direcciones de memoria empalmadas." << endl << endl;
-  cout << "Introduzca el nombre del archivo por leer: ";
-  getline(cin, fileName);
-
-  file.open(fileName.c_str());
-
-  if(!file.is_open()) {
-      cout << endl << "No se pudo abrir el archivo. Verifique que el archivo exista y que el nombre sea correcto." << endl;
-      return;
+// Función que reporta un error de ejecución (por ejemplo: "OVERFLOW").
+// En modo sin menú el error se guarda junto con el número de paso en vez de mostrarse.
+// Parámetro: el mensaje de error.
+// Valor de retorno: ninguno.
+void Machine::reportError(string msg) {
+  if(trace)
+    trace->errors.push_back(msg);
+  if(headlessMode) {
+    if(diagnostics.size() < MAXDIAGNOSTICS)
+      diagnostics.push_back(toString(steps) + " " + msg);
+    diagnosticsCount++;
+  } else if (animation.isRunning()) {
+    animation.message(msg);
   } else {
-      cout << endl << "Leyendo archivo..." << endl << endl;
+    cout << msg << endl;
   }
+}
 
-  // ints to store operation code, addressing type and parameter value. They will be merged to form an instruction.
-  int opCode, addrType;
-  string param;
-  int i = 0;
-  while(getline(file, line)) {
-
-      if(!onlyShowErrors)
-          cout << "Leyendo línea " << setw(3) << setfill('0') << i << "..." << endl;
-
-      line = toUpper(line);
-
-      // If the line is empty, store as empty string("").
-      if(line.empty()) {
-          if(!onlyShowErrors)
-              cout << "  Línea vacía encontrada." << endl;
-
-          data[i] = "";
-          cout << endl;
-      } else {
-          istringstream inStream(line);
-          ostringstream outStream;
-
-          // This should contain the operation (e.g. "LDA" or "CLA").
-          inStream >> segment;
-          opCode = getOpCode(segment);
-
-          // If operation is an instruction which doesn't take parameters...
-          if(codes[opCode] == "HLT" || codes[opCode] == "NEG" || codes[opCode] == "CLA" || codes[opCode] == "NOP") {
-                  outStream << setw(2) << setfill('0') << opCode;
-                  outStream << "0000";
-                  data[i] = outStream.str();
-
-                  if(!onlyShowErrors) {
-                      cout << "  Operación que no necesita parámetros encontrada." << endl;
-                      cout << "  " << data[i] << endl << endl;
-                  }
-
-            // If operation code is valid...
-          } else if(opCode != -1) {
-              if(!onlyShowErrors)
-                  cout << "  Operación encontrada." << endl;
-
-              // This should contain the addressing type (e.g. "ABS" or "INM").
-              inStream >> segment;
-              addrType = getAddrType(segment);
-
-              if(addrType != -1) {
-                  if(!onlyShowErrors)
-                      cout << "  Tipo de direccionamiento encontrado." << endl;
-
-
-                  // This should contain the parameter value, a three digit number (e.g. "020" or "123").
-                  inStream >> segment;
-
-                  if(segment.length() == 3) {
-
-                      // If addressing type is ABS or IND...
-                      if(addrType == 1 || addrType == 2) {
-                        if(segment[0] == '+'  || segment[0] == '-') {
-                        	cout << "  ERROR: El parámetro no puede tener signo para ese tipo de direccionamiento." << endl;
-                          return;
-                        }
-                      }
-
-                      param = segment;
-
-                      outStream << setw(2) << setfill('0') << opCode;
-                      outStream << addrType;
-                      outStream << param;
-
-                      data[i] = outStream.str();
-
-                      if(!onlyShowErrors) {
-                          cout << "  Valor de parámetro encontrado." << endl;
-                          cout << "  " << data[i] << endl << endl;
-                      }
-
-                  } else {
-                      if(onlyShowErrors)
-                          cout << "Línea " << setw(3) << setfill('0') << i << ": ";
-
-                      cout << "  ERROR: no se encontró un valor de parámetro válido." << endl;
-                      compileSuccess = false;
-                      return;
-                  }
-              } else {
-                  if(onlyShowErrors)
-                          cout << "Línea " << setw(3) << setfill('0') << i << ": ";
-
-                  cout << "  ERROR: no se encontró un tipo de direccionamiento válido." << endl;
-                  compileSuccess = false;
-                  return;
-              }
-
-          // If operation code is invalid but it's a value (values start with the sign and must be six characters long)...
-          } else if( (line[0] == '+' || line[0] == '-') &&  line.length() == 6 ) {
-              data[i] = line;
-
-              if(!onlyShowErrors) {
-                  cout << "  Valor/dato encontrado." << endl;
-                  cout << "  " << data[i] << endl << endl;
-              }
-
-          // If operation code is invalid and it's not a value...
-          } else {
-
-              if(onlyShowErrors)
-                          cout << "Línea " << setw(3) << setfill('0') << i << ": ";
-
-            cout << "  ERROR: no se encontró una operación o valor/dato válido." << endl;
-              compileSuccess = false;
-              return;
-          }
-      }
-      i++;
+// Función que vacía la memoria del simulador.
+// Parámetros: ninguno.
+// Valor de retorno: ninguno.
+void Machine::emptyMemory() {
+  for(int i = 0; i < MEMSIZE; i++) {
+    data[i] = Word::empty();
   }
+  decodeMemory();
+}
+
+// Constructor: máquina con la memoria vacía, en modo interactivo y con superinstrucciones.
+Machine::Machine() : PC(0), PCprev(0), MAR(0), headlessMode(false), steps(0), diagnosticsCount(0), microops(0),
+                     fusionEnabled(true), trace(NULL), lastWrite(-1), watchAC(false), breakReason(BREAK_NONE), breakCell(0),
+                     stepLimit(LLONG_MAX) {
+  MDR = AC = IR = watchACValue = breakOld = Word::empty();
+  memset(breakpoints, 0, sizeof breakpoints);
+  memset(watchedCells, 0, sizeof watchedCells);
+#if defined(__x86_64__) && defined(__linux__)
+  jitBuffer = NULL;
+  jitUsed = 0;
+#endif
+  emptyMemory();
+}
 
-  cout << "Lectura de archivo finalizada." << endl;
+// Constructor de copia: copia la memoria, la predecodificación, los registros, los errores y los puntos de
+// interrupción, pero no el historial, el trazo ni las traducciones del JIT (la copia traduce las suyas si usa ese motor).
+Machine::Machine(const Machine &other)
+  : PC(other.PC), PCprev(other.PCprev), MAR(other.MAR), MDR(other.MDR), AC(other.AC), IR(other.IR),
+    headlessMode(other.headlessMode), steps(other.steps), diagnostics(other.diagnostics),
+    diagnosticsCount(other.diagnosticsCount), microops(other.microops), fusionEnabled(other.fusionEnabled),
+    trace(NULL), lastWrite(-1), watchAC(other.watchAC), watchACValue(other.watchACValue), breakReason(BREAK_NONE), breakCell(0),
+    breakOld(Word::empty()), stepLimit(LLONG_MAX) {
+  memcpy(data, other.data, sizeof data);
+  memcpy(breakpoints, other.breakpoints, sizeof breakpoints);
+  memcpy(watchedCells, other.watchedCells, sizeof watchedCells);
+  memcpy(decoded, other.decoded, sizeof decoded);
+  memcpy(occupied, other.occupied, sizeof occupied);
+  memset(disasmValid, 0, sizeof disasmValid);
+#if defined(__x86_64__) && defined(__linux__)
+  jitBuffer = NULL;
+  jitUsed = 0;
+#endif
+}
 
-  if(compileSuccess) {
-      cout << "Carga exitosa." << endl;
-  } else {
-      cout << "No fue posible cargar el contenido del archivo por uno o mas errores.";
-  }
+/*
+  Funcion que bifurca la máquina: crea una copia con algunas celdas cambiadas que puede continuar la ejecución
+  con resume(). No se vuelve a cargar el programa ni a predecodificar toda la memoria, sólo las celdas cambiadas.
+  La copia no comparte memoria con el original: copia data y decoded completos (unos 10 KB en la máquina
+  clásica, 12 MB con ADDRDIGITS=6). Compartirlos por bloques con copia al escribir obligaría a todos los
+  motores, al JIT y al motor SIMD, que usan data como un arreglo contiguo, a pasar por una indirección en
+  cada acceso; por eso runForks limita cuántas copias existen a la vez (FORKBUDGET).
+  Parámetros: las celdas (dirección y palabra) que cambian en la copia.
+  Valor de retorno: la máquina nueva.
+*/
+unique_ptr<Machine> Machine::fork(const vector<pair<int, Word> > &cells) const {
+  unique_ptr<Machine> child(new Machine(*this));
+  for (size_t k = 0; k < cells.size(); k++)
+    child->writeMemory(cells[k].first, cells[k].second);
+  return child;
+}
 
-  file.close();
+// Destructor: libera el buffer ejecutable del JIT, si se reservó.
+Machine::~Machine() {
+#if defined(__x86_64__) && defined(__linux__)
+  if (jitBuffer != NULL)
+    munmap(jitBuffer, JITBUFSIZE);
+#endif
 }
 
 /*
-  Función que vacía la memoria del simulador.
+	Función que limpia la pantalla.
   Parámetros: ninguno.
   Valor de retorno: ninguno.
 */
-void clearMemory() {
-  int option;
-  cout << "¿Está seguro de que desea vaciar la memoria?\n  1 Si\n  2 No\n => ";
-  cin >> option;
-  cout << endl;
+void refreshScreen() {
+  cout << string(80, '\n');
+}
 
-  if(option == 1) {
-      emptyMemory();
-      cout << "Memoria vaciada." << endl;
-  } else {
-      cout << "No se vació la memoria." << endl;
-  }
+/*
+  Pantalla de la animación de las microoperaciones para terminales con secuencias ANSI.
 
-  // Reset option value.
-  option = 3;
+  Guarda los renglones de la imagen que está en la terminal (front) y, al presentar una imagen nueva,
+  sólo mueve el cursor a los renglones que cambiaron y los reescribe, todo en una sola escritura.
+  Así cada microoperación manda unos cuantos renglones en vez de 80 saltos de línea y toda la memoria,
+  que por SSH era lo que más tardaba. Las imágenes se limitan a MAXFPS por segundo: las microoperaciones
+  que ocurren antes se juntan en la siguiente imagen (o en la última, al terminar la ejecución).
+*/
+
+// Máximo de imágenes por segundo de la animación.
+#define MAXFPS 30
+
+class ScreenRenderer {
+public:
+  ScreenRenderer() : frontLines(0), cleared(false) {}
+  // La siguiente imagen limpia la pantalla y se dibuja completa.
+  void reset() { cleared = false; frontLines = 0; }
+  // Regresa true si ya pasó el intervalo mínimo desde la última imagen.
+  bool due();
+  void present(const string &frame);
+
+  // Texto de la imagen que arma la máquina (se reutiliza, como los renglones).
+  string frame;
+
+private:
+  // front: renglones en la terminal (los primeros frontLines); back: los de la imagen nueva.
+  vector<string> front, back;
+  size_t frontLines;
+  string out;
+  bool cleared;
+  chrono::steady_clock::time_point lastFrame;
+};
+
+bool ScreenRenderer::due() {
+  chrono::steady_clock::time_point now = chrono::steady_clock::now();
+  return !cleared || now - lastFrame >= chrono::microseconds(1000000 / MAXFPS);
 }
 
 /*
-  Función que muestra el submenú de opciones.
-  Parámetros: ninguno.
+  Funcion que presenta una imagen reescribiendo sólo los renglones distintos a los de la anterior.
+  Parámetros: el texto de la imagen (renglones separados por '\n').
   Valor de retorno: ninguno.
 */
-void showOptions() {
- 	// Opciones sobre cómo mostrar la memoria, velocidad de procesamiento, etcétera.
-  int option;
-  do {
-      cout << "Seleccione la opción que desea cambiar (X = activado):" << endl;
-      cout << "  1 " << getBoolX(showWholeMemory) << " Mostrar el contenido completo de la memoria" << endl;
-      cout << "  2 " << getBoolX(onlyShowErrors)  << " Mostrar sólo los errores al cargar un archivo en memoria" << endl;
-    	cout << "  3 " << "[" << secs << "] Intervalo en segundos entre la ejecución de microoperaciones" << endl;
-      cout << "  0 Volver al menú principal" << endl;
-      cout << " => ";
-      cin >> option;
-      cout << endl;
+void ScreenRenderer::present(const string &frame) {
+  // Renglones de la imagen nueva, con los tabuladores expandidos para que cada renglón cubra
+  // todas las columnas que escribe (un tabulador no borraría lo que quedó de la imagen anterior).
+  // Los renglones y la salida se reutilizan de una imagen a otra, así que no se reserva memoria.
+  size_t lines = 0;
+  for (size_t i = 0; i < frame.size(); ) {
+    if (lines == back.size())
+      back.push_back(string());
+    string &line = back[lines++];
+    line.clear();
+    for (; i < frame.size() && frame[i] != '\n'; i++) {
+      if (frame[i] == '\t')
+        line.append(8 - line.size() % 8, ' ');
+      else
+        line += frame[i];
+    }
+    i++;
+  }
 
-      if(option == 1)
-        showWholeMemory = !showWholeMemory;
-      else if(option == 2)
-      	onlyShowErrors = !onlyShowErrors;
-      else if(option == 3) {
-        cout << endl << "Introduzca la nueva duración del intervalo en segundos: ";
-        double secsDouble;
-        cin >> secsDouble;
-        secs = static_cast<int>(secsDouble);
-        cout << endl;
-      }
+  out.clear();
+  if (!cleared) {
+#ifdef _WIN32
+    // La consola de Windows 10 interpreta las secuencias ANSI si se le pide.
+    HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+    DWORD mode;
+    if (GetConsoleMode(console, &mode))
+      SetConsoleMode(console, mode | 0x0004); // ENABLE_VIRTUAL_TERMINAL_PROCESSING
+#endif
+    out += "\x1b[H\x1b[2J";
+    frontLines = 0;
+    cleared = true;
+  }
+  for (size_t i = 0; i < lines; i++) {
+    if (i >= frontLines || front[i] != back[i]) {
+      out += "\x1b[";
+      appendNumber(out, i + 1);
+      out += ";1H";
+      out += back[i];
+      out += "\x1b[K";
+    }
+  }
+  if (lines < frontLines) {
+    out += "\x1b[";
+    appendNumber(out, lines + 1);
+    out += ";1H\x1b[J";
+  }
+  // El cursor queda debajo de la imagen, donde escriben los mensajes de error y el menú.
+  out += "\x1b[";
+  appendNumber(out, lines + 1);
+  out += ";1H";
+
+  cout.write(out.data(), out.size());
+  cout.flush();
+  front.swap(back);
+  frontLines = lines;
+  lastFrame = chrono::steady_clock::now();
+}
 
-      refreshScreen();
+// Pantalla de la animación de la máquina del menú.
+ScreenRenderer screen;
 
-  } while(option != 0);
+/*
+  Ritmo de la animación. Cada microoperación espera hasta un plazo absoluto (el plazo anterior más su intervalo)
+  en vez de dormir el intervalo a partir de que termina la anterior, así que el tiempo que tarda la ejecución no
+  se acumula como retraso. En Linux se duerme con clock_nanosleep sobre CLOCK_MONOTONIC (el reloj de
+  steady_clock); en los demás sistemas con sleep_until. Si la ejecución se atrasa más de un intervalo (por
+  ejemplo, si se suspendió el proceso), el plazo se reinicia en vez de correr para alcanzarlo.
+*/
+class Pacer {
+public:
+  // Empieza a contar los plazos desde ahora.
+  void reset() { deadline = chrono::steady_clock::now(); }
+  void wait(double seconds);
 
+private:
+  chrono::steady_clock::time_point deadline;
+};
 
-  // Reset option value.
-  option = 6;
+/*
+  Funcion que espera hasta el siguiente plazo.
+  Parámetros: el intervalo en segundos desde el plazo anterior.
+  Valor de retorno: ninguno.
+*/
+void Pacer::wait(double seconds) {
+  if (seconds <= 0)
+    return;
+  chrono::steady_clock::duration interval =
+    chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(seconds));
+  deadline += interval;
+  chrono::steady_clock::time_point now = chrono::steady_clock::now();
+  if (now - deadline > interval) {
+    deadline = now;
+    return;
+  }
+#ifdef __linux__
+  long long ns = chrono::duration_cast<chrono::nanoseconds>(deadline.time_since_epoch()).count();
+  struct timespec until;
+  until.tv_sec = ns / 1000000000;
+  until.tv_nsec = ns % 1000000000;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR) {
+  }
+#else
+  this_thread::sleep_until(deadline);
+#endif
 }
 
-// Función que completa una palabra al número necesario de caracteres, rellenando con 0.
-// Parámetros: un número entero.
-// Valor de retorno: string con el AC ajustado.
-string completeAC(int iTemp) {
+// Ritmo de la animación de la máquina del menú.
+Pacer pacer;
+
+// Función que escribe una dirección con al menos ADDRDIGITS dígitos (por ejemplo: "007").
+// Parámetros: la dirección y el arreglo.
+// Valor de retorno: el arreglo.
+char *formatAddress(int dir, char *buf) {
+  char digits[FMTBUFSIZE];
+  int len = to_chars(digits, digits + FMTBUFSIZE, dir).ptr - digits;
+  int pad = len < ADDRDIGITS ? ADDRDIGITS - len : 0;
+  memset(buf, '0', pad);
+  memcpy(buf + pad, digits, len);
+  buf[pad + len] = '\0';
+  return buf;
+}
+
+/*
+	Funcion que completa el PC con los ceros requeridos para mostrarlo.
+  Parametros: PC.
+	Valor de retorno: string con el PC completo.
+*/
+string completePC(int iPC) {
+  char buf[FMTBUFSIZE];
+  return formatAddress(iPC, buf);
+}
 
-  string str = toString(iTemp);
-  ostringstream complete;
+// Nombres de los tipos de direccionamiento en ensamblador (vacío si no es válido).
+const char *addrNames[16] = {"", "ABS", "IND", "INM", "REL", "", "", "", "", "", "", "", "", "", "", ""};
+
+// Función que convierte de maquinal a ensamblador (por ejemplo: "LDA ABS 005" o "CLA  ").
+// Parámetros: la instrucción en maquinal y el arreglo.
+// Valor de retorno: el arreglo.
+char *formatAssembly(Word inst, char *buf) {
+  char word[FMTBUFSIZE];
+  formatWord(inst, word);
+  int op = inst.opCode();
+  const char *code = op < 9 ? codes[op].c_str() : "???";
+  // NOP, CLA, NEG y HLT no tienen parámetro.
+  const char *parameter = op == 0 || op == 1 || op == 6 || op == 8 ? "" : word + 3;
+
+  char *p = buf;
+  p += strlen(strcpy(p, code));
+  *p++ = ' ';
+  p += strlen(strcpy(p, addrNames[inst.addrType()]));
+  *p++ = ' ';
+  strcpy(p, parameter);
+  return buf;
+}
 
-  if(str[0] == '-') {
-    str = str.substr(1);
-    complete << '-';
-  } else {
-  	complete << '+';
+// Función que obtiene el ensamblador de una celda, convirtiéndola sólo si cambió desde la última vez.
+// Parámetro: la dirección de la celda (debe contener una instrucción).
+// Valor de retorno: el texto en ensamblador.
+const char *Machine::disassemble(int dir) {
+  uint64_t bit = 1ULL << (dir & 63);
+  if(!(disasmValid[dir >> 6] & bit)) {
+    formatAssembly(data[dir], disasmCache[dir]);
+    disasmValid[dir >> 6] |= bit;
   }
+  return disasmCache[dir];
+}
 
-  for(int i = 0; i < 5 - str.length(); i++) {
-  	complete << 0;
+// Función que convierte de maquinal a ensamblador.
+// Parámetros: string con la instrucción en maquinal.
+// Valor de retorno: string con la instrucción en esamblador.
+string convertAssemb(Word inst) {
+  char buf[FMTBUFSIZE];
+  return formatAssembly(inst, buf);
+}
+
+/*
+  Funcion que muestra las direcciones de memoria, su contenido y la dirección ejecutándose actualmente.
+  Parámetros: el string donde se agrega.
+  Valor de retorno: ninguno.
+*/
+void Machine::showMemoryReg(string &out) {
+  char buf[FMTBUFSIZE];
+  for(int i = nextOccupied(0); i < MEMSIZE; i = nextOccupied(i + 1)) {
+    out += formatAddress(i, buf);
+    out += '\t';
+    formatWord(data[i], buf);
+    out += buf;
+    if(data[i].isInstruction()) {
+      const char *assembly = disassemble(i);
+      out += "  ";
+      out += assembly;
+      if(i == PCprev)
+        appendPadded(out, "<==", 15 - strlen(assembly));
+    }
+    out += '\n';
   }
+  out += '\n';
+}
 
-  complete << str;
+/*
+	Funcion que muestra en pantalla los registros y sus cambios
+  Parametros: el tipo de microoperación, que decide cuánto se espera antes de mostrarla.
+  valor de retorno: ninguno.
+*/
+void Machine::displayChanges(MicroOpKind kind) {
+  microops++;
+  if(headlessMode)
+    return;
+
+  if(!maxSpeed)
+    pacer.wait(secs * microopScale[kind]);
+  animation.publish(*this);
+}
 
-  return complete.str();
+/*
+	Funcion que escribe el encabezado de la animación con los registros.
+  Parametros: el string donde se agrega.
+  valor de retorno: ninguno.
+*/
+void Machine::showRegisters(string &out) {
+  char buf[FMTBUFSIZE];
+  out += "\t\tR E G I S T R O S\n\n";
+  out += "    |   PC   |   MAR   |   MDR   |   IR   |\n";
+  appendPadded(out, formatAddress(PC, buf), 10);
+  out += ' ';
+  appendPadded(out, formatAddress(MAR, buf), 9);
+  out += ' ';
+  formatWord(MDR, buf);
+  appendPadded(out, buf, 10);
+  out += ' ';
+  formatWord(IR, buf);
+  appendPadded(out, buf, 9);
+  out += "\n\n";
+  formatWord(AC, buf);
+  appendPadded(out, "AC", 11);
+  out += ": ";
+  appendPadded(out, buf, 8);
+  out += "\n\n";
 }
 
 /*
-  Funcion que realiza la operacion CLA y pone en 0 el acumulador.
-  Parametros: Ninguno.
-  Valor de retorno: Ninguno.
+	Funcion que dibuja la imagen con el estado actual de los registros y la memoria: en la pantalla ANSI
+  sólo lo que cambió y, si no, limpiando la pantalla y escribiendo todo.
+  Parametros: ninguno.
+  valor de retorno: ninguno.
 */
-void opCLA() {
- 	 AC = "+00000";
-  displayChanges();
+void Machine::drawFrame() {
+  screen.frame.clear();
+  showRegisters(screen.frame);
+  showMemoryReg(screen.frame);
+  if(ansiScreen) {
+    screen.present(screen.frame);
+  } else {
+    refreshScreen();
+    cout << screen.frame << flush;
+  }
 }
 
 /*
-  Funcion que realiza la operacion LDA.
-  de memoria.
-  Parametros: el tipo de direccionamiento y el parametro de la instruccion ([IR]2-0).
+  Funcion que arranca el hilo de la animación con una copia de la máquina.
+  Parámetros: la máquina que se va a ejecutar.
   Valor de retorno: ninguno.
 */
-void opLDA(string sDireccionamiento, string sExtra) {
-  int iDir, iTemp;
-  string sContenido;
+void AnimationRenderer::start(const Machine &machine) {
+  view.reset(new Machine(machine));
+  memset(dirty, 0, sizeof dirty);
+  dirtyCells.clear();
+  dirtyCells.reserve(MEMSIZE);
+  screen.reset();
+  running = true;
+  worker = thread(&AnimationRenderer::run, this);
+}
 
-  switch (sDireccionamiento[0]) {
-    // Absoluto
-    case '1': {
-     	MAR = sExtra;
-      displayChanges();
-      iDir = atoi(MAR.c_str());
-      MDR = data[iDir];
-      displayChanges();
-      AC = MDR;
-      displayChanges();
-      break;
-    }
-    // Indirecto
-    case '2': {
-    	MAR = sExtra;
-      displayChanges();
-    	iDir = atoi(MAR.c_str());
-      MDR = data[iDir];
-      displayChanges();
-      MAR = MDR;
-      displayChanges();
-      iDir = atoi(MAR.c_str());
-      MDR = data[iDir];
-      displayChanges();
-      AC = MDR;
-      displayChanges();
-      break;
-    }
-    // Inmediato
-    case '3': {
-    	sContenido = completeAC(atoi(sExtra.c_str())); // Completa el string con 0 y signo respectivamente
-      AC = sContenido;
-      displayChanges();
-      break;
-    }
-    // Relativo
-    case '4': {
-     	iTemp = atoi(sExtra.c_str());
-      if (PC + iTemp < 0 || PC + iTemp > 999) {
-       	cout << "OUT OF BOUNDS" << endl;
-      }
-      else {
-        if (PC + iTemp < 100) {
-          if (PC + iTemp < 10) {
-            MAR = "00" + toString(PC + iTemp);
-          }
-          else {
-            MAR = "0" + toString(PC + iTemp);
-          }
-        }
-        else {
-          MAR = toString(PC + iTemp);
-        }
-        displayChanges();
-        MDR = data[PC + iTemp]; // MMRead
-        displayChanges();
-        AC = MDR;
-        displayChanges();
-      }
-      break;
-    }
-    default: {
-     	cout << "INSTRUCCION NO VALIDA" << endl;
+/*
+  Funcion que publica los cambios de la última microoperación (la llama el hilo de la ejecución).
+  Parámetros: la máquina.
+  Valor de retorno: ninguno.
+*/
+void AnimationRenderer::publish(Machine &machine) {
+  if (machine.lastWrite >= 0) {
+    if (!dirty[machine.lastWrite]) {
+      dirty[machine.lastWrite] = true;
+      dirtyCells.push_back(machine.lastWrite);
     }
+    machine.lastWrite = -1;
+  }
+  if (!flushWrites(machine))
+    return;
+
+  RenderEvent event;
+  event.kind = RE_REGISTERS;
+  event.PC = machine.PC;
+  event.PCprev = machine.PCprev;
+  event.MAR = machine.MAR;
+  event.MDR = machine.MDR;
+  event.IR = machine.IR;
+  event.AC = machine.AC;
+  ring.push(event);
+}
+
+// Publica las celdas escritas pendientes, con su valor actual; regresa false si no cupieron todas.
+bool AnimationRenderer::flushWrites(const Machine &machine) {
+  while (!dirtyCells.empty()) {
+    int cell = dirtyCells.back();
+    RenderEvent event;
+    event.kind = RE_WRITE;
+    event.cell = cell;
+    event.word = machine.data[cell];
+    if (!ring.push(event))
+      return false;
+    dirty[cell] = false;
+    dirtyCells.pop_back();
   }
+  return true;
+}
+
+// Publica un evento esperando a que haya lugar en la cola (sólo para los mensajes y el final).
+void AnimationRenderer::pushWait(const RenderEvent &event) {
+  while (!ring.push(event))
+    this_thread::yield();
 }
 
 /*
-  Funcion que realiza la operacion STA.
-  Parametros: el tipo de direccionamiento y el parametro de la instruccion ([IR]2-0).
+  Funcion que publica un mensaje de error para que el hilo lo escriba debajo de la imagen.
+  Parámetros: el mensaje.
   Valor de retorno: ninguno.
 */
-void opSTA(string sDireccionamiento, string sExtra) {
-	int iDir, iTemp;
-  string sContenido;
+void AnimationRenderer::message(const string &msg) {
+  RenderEvent event;
+  event.kind = RE_MESSAGE;
+  snprintf(event.message, RENDERMSGSIZE, "%s", msg.c_str());
+  pushWait(event);
+}
 
-  switch (sDireccionamiento[0]) {
-    // Absoluto
-    case '1': {
-     	MAR = sExtra;
-      displayChanges();
-      iDir = atoi(MAR.c_str());
-      MDR = AC;
-      displayChanges();
-      data[iDir] = MDR; // MMWrite
-      displayChanges();
-      break;
-    }
-    // Indirecto
-    case '2': {
-    	MAR = sExtra;
-      displayChanges();
-    	iDir = atoi(MAR.c_str());
-      MDR = data[iDir];
-      displayChanges();
-      MAR = MDR;
-      displayChanges();
-      iDir = atoi(MAR.c_str());
-      MDR = AC;
-      displayChanges();
-      data[iDir] = MDR; // MMWrite
-      displayChanges();
-      break;
-    }
-    // Relativo
-    case '4': {
-     	iTemp = atoi(sExtra.c_str());
-      if (PC + iTemp < 0 || PC + iTemp > 999) {
-       	cout << "OUT OF BOUNDS" << endl;
-      }
-      else {
-      	if (PC + iTemp < 100) {
-          if (PC + iTemp < 10) {
-            MAR = "00" + toString(PC + iTemp);
-          }
-          else {
-            MAR = "0" + toString(PC + iTemp);
-          }
-        }
-        else {
-          MAR = toString(PC + iTemp);
-        }
-        displayChanges();
-        MDR = AC;
-        displayChanges();
-        data[PC + iTemp] = MDR; // MMWrite
-        displayChanges();
+/*
+  Funcion que publica el estado final, espera a que el hilo lo dibuje y lo termina.
+  Parámetros: la máquina.
+  Valor de retorno: ninguno.
+*/
+void AnimationRenderer::finish(const Machine &machine) {
+  while (!flushWrites(machine))
+    this_thread::yield();
+  RenderEvent event;
+  event.kind = RE_REGISTERS;
+  event.PC = machine.PC;
+  event.PCprev = machine.PCprev;
+  event.MAR = machine.MAR;
+  event.MDR = machine.MDR;
+  event.IR = machine.IR;
+  event.AC = machine.AC;
+  pushWait(event);
+  event.kind = RE_END;
+  pushWait(event);
+  worker.join();
+  running = false;
+}
+
+/*
+  Funcion del hilo de la animación: aplica los cambios de la cola a su copia de la máquina y dibuja.
+  Parámetros: ninguno.
+  Valor de retorno: ninguno.
+*/
+void AnimationRenderer::run() {
+  RenderEvent event;
+  bool changed = false;
+  for (;;) {
+    bool got = false;
+    while (ring.pop(event)) {
+      got = true;
+      if (event.kind == RE_REGISTERS) {
+        view->PC = event.PC;
+        view->PCprev = event.PCprev;
+        view->MAR = event.MAR;
+        view->MDR = event.MDR;
+        view->IR = event.IR;
+        view->AC = event.AC;
+        changed = true;
+      } else if (event.kind == RE_WRITE) {
+        view->writeMemory(event.cell, event.word);
+        changed = true;
+      } else if (event.kind == RE_MESSAGE) {
+        if (changed)
+          view->drawFrame();
+        changed = false;
+        cout << event.message << endl;
+      } else {
+        if (changed)
+          view->drawFrame();
+        return;
       }
-      break;
     }
-    default: {
-     	cout << "INSTRUCCION NO VALIDA" << endl;
+    if (changed && screen.due()) {
+      view->drawFrame();
+      changed = false;
+    } else if (!got) {
+      this_thread::sleep_for(chrono::milliseconds(1));
     }
   }
 }
 
+// Función que regresa un string que contiene cómo se mostrará la opción de acuerdo con su estado (activado/desactivado).
+// Parámetros: una variable booleana.
+// Valor de retorno: un string que contiene cómo se mostrará la opción.
+string getBoolX(bool var) {
+    if(var)
+        return "[X]";
+    else
+        return "[ ]";
+}
+
 /*
-  Funcion que realiza la operacion ADD.
-  Parametros: el tipo de direccionamiento y el parametro de la instruccion ([IR]2-0).
+  Funcion que muestra las direcciones de memoria y su contenido.
+  Parámetros: ninguno.
   Valor de retorno: ninguno.
 */
-void opADD(string sDireccionamiento, string sExtra) {
-	int iDir, iTemp, iTemp2;
-  string sContenido;
+void showMemory() {
+  if(showWholeMemory) {
+    for(int i = 0; i < 10; i++) {
+        cout << "\t" << setw(2) << setfill('0') << i;
+    }
 
-  switch (sDireccionamiento[0]) {
-    // Absoluto
-    case '1': {
-     	MAR = sExtra;
+    cout << endl;
+
+    for(int i = 0; i < MEMSIZE; i += 10) {
+        cout << setw(ADDRDIGITS) << setfill('0') << i;
+
+        for(int j = i; j < i + 10; j++) {
+                cout << "\t" << sim.data[j];
+        }
+        cout << endl;
+    }
+
+    cout << endl << endl;
+  }
+  else {
+    cout << "Se muestran solo las direcciones de memoria no vacias:" << endl << endl;
+    for(int i = sim.nextOccupied(0); i < MEMSIZE; i = sim.nextOccupied(i + 1)) {
+      if(sim.data[i].isInstruction()) {
+            cout << setw(ADDRDIGITS) << setfill('0') << i << "\t" << sim.data[i] << "  " << sim.disassemble(i) << endl;
+      }
+      else {
+       cout << setw(ADDRDIGITS) << setfill('0') << i << "\t" << sim.data[i] << endl;
+      }
+    }
+  }
+
+  cout << endl;
+}
+
+
+/*
+  Función que edita el contenido de una dirección de memoria directamente.
+  Parámetros: ninguno.
+  Valor de retorno: ninguno.
+*/
+void editMemoryDirectly() {
+  int dir;
+  string val;
+
+  cout << "Introduzca la direccion de memoria por modificar: ";
+  cin >> dir;
+  if(dir < 0 || dir >= MEMSIZE) {
+    cout << "ERROR: la dirección no es válida." << endl;
+    return;
+  }
+
+  cout << "La dirección " << setw(ADDRDIGITS) << setfill('0') << dir << " contiene: ";
+  if(sim.data[dir].isEmpty())
+      cout << "(vacío)";
+  else if(sim.data[dir].isData())
+      cout << sim.data[dir];
+  else
+      cout << sim.data[dir] << "   (" << convertAssemb(sim.data[dir]) << ")";
+  cout << endl;
+
+  cout << "Introduzca el nuevo valor: ";
+  cin >> val;
+  cout << endl;
+
+  // Validation process starts here.
+
+  // If it's data/value...
+  if(val[0] == '+' || val[0] == '-') {
+  	if(!parseWord(val, sim.data[dir]))
+      cout << "ERROR: el valor/dato no es válido.";
+  } else {
+  	// If it's an instruction...
+    string opCode, addr, param;
+    int iOpCode, iAddr;
+
+    opCode = val.substr(0, 2);
+    iOpCode = atoi(opCode.c_str());
+    // If it's a valid operation code...
+    if(iOpCode >= 0 && iOpCode < 9) {
+    	addr = val.substr(2, 1);
+		iAddr = atoi(addr.c_str());
+
+      // If it's an instruction which doesn't take parameters, set addressing type to 1 to make it valid.
+      if(iOpCode == 0 || iOpCode == 1 || iOpCode == 6 || iOpCode == 8)
+        iAddr = 1;
+
+      // If it's a valid addressing type...
+      if(iAddr >= 1 && iAddr <= 4) {
+    		param = val.substr(3);
+
+        // If parameter is ADDRDIGITS characters long...
+        if(param.length() == ADDRDIGITS) {
+
+          // If addressing type is ABS or IND...
+          if(iAddr == 1 || iAddr == 2) {
+            if(param[0] == '+'  || param[0] == '-') {
+              cout << "  ERROR: El parámetro no puede tener signo para ese tipo de direccionamiento." << endl;
+              return;
+            }
+          }
+
+          Word w;
+          if(parseWord(val, w)) {
+			  // Success. Save to memory.
+        	  sim.data[dir] = w;
+  				  cout << "Dirección de memoria modificada exitosamente.";
+          } else {
+            cout << "ERROR: la instrucción contiene caracteres no válidos.";
+          }
+        } else {
+        	cout << "ERROR: el parámetro debe ser de " << ADDRDIGITS << " caracteres.";
+        }
+      } else {
+        cout << "ERROR: el tipo de direccionamiento no es válido.";
+      }
+    } else {
+    	cout << "ERROR: el código de operación no es válido.";
+    }
+
+  }
+   // Actualiza la predecodificación y el índice de celdas ocupadas.
+   sim.writeMemory(dir, sim.data[dir]);
+   cout << endl;
+}
+
+/*
+  Función que edita el contenido de una dirección de memoria con la instrucción dada.
+  Parámetros: ninguno.
+  Valor de retorno: ninguno.
+*/
+void editMemory() {
+  int dir;
+  string line;
+
+  cout << "Introduzca la dirección de memoria por modificar: ";
+  cin >> dir;
+  cin.ignore();
+  if(dir < 0 || dir >= MEMSIZE) {
+    cout << "ERROR: la dirección no es válida." << endl;
+    return;
+  }
+
+  cout << "La dirección " << setw(ADDRDIGITS) << setfill('0') << dir << " contiene: ";
+  if(sim.data[dir].isEmpty())
+      cout << "(vacío)";
+  else if(sim.data[dir].isData())
+      cout << sim.data[dir];
+  else
+      cout << sim.data[dir] << "   (" << convertAssemb(sim.data[dir]) << ")";
+  cout << endl;
+
+  cout << "Introduzca el nuevo contenido en ensamblador (por ejemplo, LDA ABS 003): ";
+  getline(cin, line);
+
+  AsmResult result = assembleLine(line, sim.data[dir]);
+  if(result >= ASM_ERR_OPERATION) {
+    cout << "ERROR: " << asmErrors[result - ASM_ERR_OPERATION] << endl;
+    return;
+  }
+  if(result != ASM_EMPTY)
+    cout << sim.data[dir] << endl << endl;
+
+  // Actualiza la predecodificación y el índice de celdas ocupadas.
+  sim.writeMemory(dir, sim.data[dir]);
+  cout << endl << "Dirección de memoria modificada exitosamente." << endl;
+}
+
+/*
+  Función que ensambla el texto de un programa y, si no tiene errores, lo carga en la memoria (la línea i en
+  la celda i) y la predecodifica. Se revisan todas las líneas y se reporta cada error con su número de línea;
+  con algún error la memoria no cambia.
+  Parámetros: el texto del programa y el flujo en el que se muestran los mensajes de la carga.
+  Valor de retorno: true si el contenido se cargó sin errores.
+*/
+bool Machine::loadProgram(string_view text, ostream &out) {
+  // Se ensambla sobre una copia para no dejar un programa a medias en la memoria.
+  vector<Word> words(data, data + MEMSIZE);
+  int errors = 0;
+
+  size_t pos = 0;
+  for (int i = 0; pos < text.size(); i++) {
+    size_t end = text.find('\n', pos);
+    if (end == string_view::npos)
+      end = text.size();
+    string_view line = text.substr(pos, end - pos);
+    pos = end + 1;
+    // Archivos con fin de línea de Windows.
+    if (!line.empty() && line.back() == '\r')
+      line.remove_suffix(1);
+
+    // La línea i va a la celda i; después de la última celda sólo se aceptan líneas en blanco.
+    if (i >= MEMSIZE) {
+      size_t start = 0;
+      if (!nextToken(line, start).empty()) {
+        out << "Línea " << i << ":   ERROR: el programa tiene más líneas que celdas la memoria ("
+            << MEMSIZE << ")." << endl;
+        errors++;
+        break;
+      }
+      continue;
+    }
+
+    if (!onlyShowErrors)
+      out << "Leyendo línea " << setw(ADDRDIGITS) << setfill('0') << i << "..." << endl;
+
+    AsmResult result = assembleLine(line, words[i]);
+
+    if (!onlyShowErrors) {
+      if (result == ASM_EMPTY)
+        out << "  Línea vacía encontrada." << endl;
+      else if (result == ASM_NOPARAM)
+        out << "  Operación que no necesita parámetros encontrada." << endl;
+      else if (result == ASM_DATA)
+        out << "  Valor/dato encontrado." << endl;
+      if (result == ASM_INSTRUCTION || result == ASM_ERR_ADDRTYPE || result == ASM_ERR_PARAM || result == ASM_ERR_SIGNED)
+        out << "  Operación encontrada." << endl;
+      if (result == ASM_INSTRUCTION || result == ASM_ERR_PARAM || result == ASM_ERR_SIGNED)
+        out << "  Tipo de direccionamiento encontrado." << endl;
+      if (result == ASM_INSTRUCTION)
+        out << "  Valor de parámetro encontrado." << endl;
+      if (result == ASM_NOPARAM || result == ASM_INSTRUCTION || result == ASM_DATA)
+        out << "  " << words[i] << endl;
+    }
+
+    if (result >= ASM_ERR_OPERATION) {
+      if (onlyShowErrors)
+        out << "Línea " << setw(ADDRDIGITS) << setfill('0') << i << ": ";
+      out << "  ERROR: " << asmErrors[result - ASM_ERR_OPERATION] << endl;
+      errors++;
+    }
+
+    if (!onlyShowErrors)
+      out << endl;
+  }
+
+  out << "Lectura de archivo finalizada." << endl;
+
+  if (errors == 0) {
+    memcpy(data, words.data(), sizeof data);
+    decodeMemory();
+    out << "Carga exitosa." << endl;
+  } else {
+    out << "No fue posible cargar el contenido del archivo por " << errors << (errors == 1 ? " error." : " errores.")
+        << endl;
+  }
+
+  return errors == 0;
+}
+
+/*
+  Imagen binaria de la memoria (extensión .simg): la memoria ya ensamblada, para cargarla sin volver a leer
+  el texto del programa (por ejemplo, para ejecutar miles de veces el mismo programa en el modo por lotes).
+
+  Formato (en el orden de bytes de la máquina que la escribe):
+    ImageHeader, las MEMSIZE palabras empacadas (int32, como Word) y, si sections tiene IMAGE_PREDECODED,
+    las MEMSIZE instrucciones predecodificadas (DecodedInst, sin superinstrucciones).
+  La sección predecodificada sólo se usa si la escribió un simulador con los mismos manejadores
+  (handlerCount y decodedSize iguales) y coincide entrada por entrada con las palabras; si no, las palabras
+  se predecodifican al cargar. Se carga con mmap (en Windows se lee el archivo) y se rechaza la imagen si
+  alguna palabra no es válida (isValidWord).
+*/
+#define IMAGEMAGIC "SIMIMAGE"
+#define IMAGEVERSION 1
+#define IMAGE_PREDECODED 1
+
+struct ImageHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t memSize;
+  uint32_t sections;
+  uint32_t handlerCount;
+  uint32_t decodedSize;
+  uint32_t reserved;
+};
+
+// Archivo de sólo lectura proyectado en memoria (o leído completo donde no hay mmap, o si no es un archivo
+// regular, como una tubería).
+class MappedFile {
+public:
+  MappedFile() : bytes(NULL), size(0), mapped(false) {}
+  ~MappedFile();
+  bool open(string fileName);
+  const char *bytes;
+  size_t size;
+
+private:
+  vector<char> contents;
+  bool mapped;
+};
+
+// Función que proyecta un archivo completo en memoria.
+// Parámetro: el nombre del archivo.
+// Valor de retorno: false si no se pudo abrir (un archivo vacío queda con size = 0).
+bool MappedFile::open(string fileName) {
+#ifdef _WIN32
+  ifstream file(fileName.c_str(), ios::binary);
+  if (!file.is_open())
+    return false;
+  contents.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+#else
+  int fd = ::open(fileName.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat info;
+  if (fstat(fd, &info) != 0 || S_ISDIR(info.st_mode)) {
+    ::close(fd);
+    return false;
+  }
+  if (S_ISREG(info.st_mode)) {
+    void *address = info.st_size > 0 ? mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    ::close(fd);
+    if (address == MAP_FAILED)
+      return false;
+    bytes = (const char *) address;
+    size = info.st_size;
+    mapped = address != NULL;
+    return true;
+  }
+  // Una tubería o un dispositivo no se puede proyectar: se lee hasta el final.
+  char chunk[65536];
+  ssize_t n;
+  while ((n = read(fd, chunk, sizeof chunk)) > 0)
+    contents.insert(contents.end(), chunk, chunk + n);
+  ::close(fd);
+  if (n < 0)
+    return false;
+#endif
+  bytes = contents.data();
+  size = contents.size();
+  return true;
+}
+
+MappedFile::~MappedFile() {
+#ifndef _WIN32
+  if (mapped)
+    munmap((void *) bytes, size);
+#endif
+}
+
+// Función que revisa si el contenido de un archivo es una imagen binaria de la memoria (por su encabezado).
+// Parámetro: el contenido del archivo.
+// Valor de retorno: true si empieza con IMAGEMAGIC.
+bool isImage(string_view contents) {
+  return contents.size() >= sizeof ImageHeader::magic
+      && memcmp(contents.data(), IMAGEMAGIC, sizeof ImageHeader::magic) == 0;
+}
+
+/*
+  Funcion que carga la memoria desde una imagen binaria. Reemplaza toda la memoria (las celdas vacías también
+  están en la imagen) y deja la memoria predecodificada.
+  Parámetros: el contenido del archivo (normalmente proyectado con MappedFile) y dónde guardar la descripción
+  del error.
+  Valor de retorno: false si no es una imagen válida (la memoria no cambia).
+*/
+bool Machine::loadImage(string_view file, string &error) {
+  ImageHeader header;
+  if (file.size() < sizeof header) {
+    error = "el archivo no es una imagen de la memoria";
+    return false;
+  }
+  memcpy(&header, file.data(), sizeof header);
+  if (memcmp(header.magic, IMAGEMAGIC, sizeof header.magic) != 0) {
+    error = "el archivo no es una imagen de la memoria";
+    return false;
+  }
+  if (header.version != IMAGEVERSION || header.memSize != MEMSIZE) {
+    error = "la imagen es de otra versión o de otro tamaño de memoria";
+    return false;
+  }
+
+  bool predecoded = (header.sections & IMAGE_PREDECODED) != 0;
+  size_t expected = sizeof header + sizeof data + (predecoded ? (size_t) MEMSIZE * header.decodedSize : 0);
+  if (file.size() != expected) {
+    error = "la imagen está incompleta";
+    return false;
+  }
+
+  // Se revisan las palabras antes de copiarlas para no cambiar la memoria si alguna no es válida.
+  for (int i = 0; i < MEMSIZE; i++) {
+    Word w;
+    memcpy(&w, file.data() + sizeof header + i * sizeof w, sizeof w);
+    if (!isValidWord(w)) {
+      error = "la celda " + completePC(i) + " no contiene una palabra válida";
+      return false;
+    }
+  }
+
+  memcpy(data, file.data() + sizeof header, sizeof data);
+
+  // La sección predecodificada sólo se usa si cada entrada es la que daría decodeWord con su palabra; si no
+  // (otra versión o un archivo modificado), los motores ejecutarían algo distinto de la memoria.
+  bool trusted = predecoded && header.handlerCount == HANDLERCOUNT && header.decodedSize == sizeof(DecodedInst);
+  const char *section = file.data() + sizeof header + sizeof data;
+  for (int i = 0; trusted && i < MEMSIZE; i++) {
+    DecodedInst d, expected = decodeWord(data[i]);
+    memcpy(&d, section + i * sizeof d, sizeof d);
+    trusted = d.opCode == expected.opCode && d.addrType == expected.addrType && d.handler == expected.handler
+        && d.param == expected.param;
+  }
+
+  if (trusted) {
+    memcpy(decoded, section, sizeof decoded);
+    for (int i = 0; i < MEMSIZE; i++)
+      fuseCell(i);
+    rebuildIndex();
+  } else {
+    decodeMemory();
+  }
+  return true;
+}
+
+/*
+  Funcion que guarda la memoria en una imagen binaria, con su sección predecodificada.
+  Parámetros: el nombre del archivo.
+  Valor de retorno: false si no se pudo escribir.
+*/
+bool Machine::saveImage(string fileName) const {
+  ImageHeader header;
+  memset(&header, 0, sizeof header);
+  memcpy(header.magic, IMAGEMAGIC, sizeof header.magic);
+  header.version = IMAGEVERSION;
+  header.memSize = MEMSIZE;
+  header.sections = IMAGE_PREDECODED;
+  header.handlerCount = HANDLERCOUNT;
+  header.decodedSize = sizeof(DecodedInst);
+
+  // Sin superinstrucciones: quien carga la imagen las forma según sus propias opciones.
+  // Campo por campo sobre ceros para que el relleno de DecodedInst no deje basura en el archivo.
+  vector<DecodedInst> plain(MEMSIZE);
+  memset(plain.data(), 0, MEMSIZE * sizeof(DecodedInst));
+  for (int i = 0; i < MEMSIZE; i++) {
+    DecodedInst d = decodeWord(data[i]);
+    plain[i].opCode = d.opCode;
+    plain[i].addrType = d.addrType;
+    plain[i].handler = d.handler;
+    plain[i].param = d.param;
+  }
+
+  ofstream file(fileName.c_str(), ios::binary);
+  file.write((const char *) &header, sizeof header);
+  file.write((const char *) data, sizeof data);
+  file.write((const char *) plain.data(), MEMSIZE * sizeof(DecodedInst));
+  file.close();
+  return !file.fail();
+}
+
+/*
+  Funcion que carga un programa desde un archivo: una imagen binaria o el texto del programa ("-" lee el texto
+  de la entrada estándar). Si el archivo no se puede leer o tiene cualquier error, la memoria no cambia.
+  Parámetros: el nombre del archivo y el flujo en el que se muestran los mensajes de la carga.
+  Valor de retorno: true si el programa se cargó sin errores.
+*/
+bool Machine::loadProgramFile(string fileName, ostream &out) {
+  // El archivo se lee una sola vez (una tubería no se puede volver a abrir para ver su encabezado).
+  MappedFile file;
+  string input;
+  string_view contents;
+  if (fileName == "-") {
+    input.assign(istreambuf_iterator<char>(cin), istreambuf_iterator<char>());
+    contents = input;
+  } else if (file.open(fileName)) {
+    contents = string_view(file.bytes, file.size);
+  } else {
+    out << "No se pudo abrir el archivo " << fileName << endl;
+    return false;
+  }
+
+  if (isImage(contents)) {
+    string error;
+    if (!loadImage(contents, error)) {
+      out << "ERROR: " << error << "." << endl;
+      return false;
+    }
+    return true;
+  }
+
+  return loadProgram(contents, out);
+}
+
+/*
+  Función que pide el nombre de un archivo y carga su contenido en la memoria del simulador.
+  Parámetros: ninguno.
+  Valor de retorno: ninguno.
+*/
+void loadFile() {
+  string fileName;
+
+  cin.ignore();
+  cout << "Se sobreescribirán las direcciones de memoria empalmadas." << endl << endl;
+  cout << "Introduzca el nombre del archivo por leer: ";
+  getline(cin, fileName);
+
+  MappedFile file;
+  if(!file.open(fileName)) {
+      cout << endl << "No se pudo abrir el archivo. Verifique que el archivo exista y que el nombre sea correcto." << endl;
+      return;
+  }
+  string_view contents(file.bytes, file.size);
+
+  // Una imagen binaria reemplaza toda la memoria y no se ensambla.
+  if(isImage(contents)) {
+    string error;
+    if(sim.loadImage(contents, error))
+      cout << endl << "Imagen de la memoria cargada." << endl;
+    else
+      cout << endl << "ERROR: " << error << "." << endl;
+    return;
+  }
+
+  cout << endl << "Leyendo archivo..." << endl << endl;
+  sim.loadProgram(contents, cout);
+}
+
+/*
+  Función que pide el nombre de un archivo y guarda en él la memoria como imagen binaria.
+  Parámetros: ninguno.
+  Valor de retorno: ninguno.
+*/
+void saveImageFile() {
+  string fileName;
+
+  cin.ignore();
+  cout << "Introduzca el nombre de la imagen por escribir (por ejemplo: programa.simg): ";
+  getline(cin, fileName);
+
+  if(sim.saveImage(fileName))
+    cout << endl << "Memoria guardada en " << fileName << "." << endl;
+  else
+    cout << endl << "No se pudo escribir el archivo " << fileName << "." << endl;
+}
+
+
+/*
+  Función que vacía la memoria del simulador.
+  Parámetros: ninguno.
+  Valor de retorno: ninguno.
+*/
+void clearMemory() {
+  int option;
+  cout << "¿Está seguro de que desea vaciar la memoria?\n  1 Si\n  2 No\n => ";
+  cin >> option;
+  cout << endl;
+
+  if(option == 1) {
+      sim.emptyMemory();
+      cout << "Memoria vaciada." << endl;
+  } else {
+      cout << "No se vació la memoria." << endl;
+  }
+
+  // Reset option value.
+  option = 3;
+}
+
+/*
+  Función que muestra el submenú de opciones.
+  Parámetros: ninguno.
+  Valor de retorno: ninguno.
+*/
+void showOptions() {
+ 	// Opciones sobre cómo mostrar la memoria, velocidad de procesamiento, etcétera.
+  int option;
+  do {
+      cout << "Seleccione la opción que desea cambiar (X = activado):" << endl;
+      cout << "  1 " << getBoolX(showWholeMemory) << " Mostrar el contenido completo de la memoria" << endl;
+      cout << "  2 " << getBoolX(onlyShowErrors)  << " Mostrar sólo los errores al cargar un archivo en memoria" << endl;
+    	cout << "  3 " << "[" << secs << "] Intervalo en segundos entre la ejecución de microoperaciones" << endl;
+      cout << "  4 " << getBoolX(profileExecution) << " Mostrar el perfil al terminar la ejecución" << endl;
+      cout << "  5 " << getBoolX(ansiScreen) << " Animación que sólo redibuja lo que cambia (terminal con ANSI)" << endl;
+      cout << "  6 " << getBoolX(maxSpeed) << " Velocidad máxima (sin esperar entre microoperaciones)" << endl;
+      cout << "  7 [" << microopScale[MO_REGISTER] << " / " << microopScale[MO_READ] << " / " << microopScale[MO_WRITE]
+           << "] Multiplicadores del intervalo: registros / lecturas / escrituras de memoria" << endl;
+      cout << "  0 Volver al menú principal" << endl;
+      cout << " => ";
+      cin >> option;
+      cout << endl;
+
+      if(option == 1)
+        showWholeMemory = !showWholeMemory;
+      else if(option == 2)
+      	onlyShowErrors = !onlyShowErrors;
+      else if(option == 3) {
+        cout << endl << "Introduzca la nueva duración del intervalo en segundos: ";
+        double secsDouble;
+        cin >> secsDouble;
+        secs = max(0.0, secsDouble);
+        cout << endl;
+      }
+      else if(option == 4)
+        profileExecution = !profileExecution;
+      else if(option == 5)
+        ansiScreen = !ansiScreen;
+      else if(option == 6)
+        maxSpeed = !maxSpeed;
+      else if(option == 7) {
+        cout << endl << "Introduzca los multiplicadores de registros, lecturas y escrituras (por ejemplo: 1 2 2): ";
+        for(int k = 0; k < MICROOPKINDS; k++) {
+          double scale;
+          cin >> scale;
+          microopScale[k] = max(0.0, scale);
+        }
+        cout << endl;
+      }
+
+      refreshScreen();
+
+  } while(option != 0);
+
+
+  // Reset option value.
+  option = 6;
+}
+
+/*
+  Funciones que leen y escriben una celda en las operaciones del motor clásico (los sitios MMRead y MMWrite)
+  y, si se está perfilando, cuentan el acceso.
+  Parámetros: la dirección de la celda (y la palabra por escribir).
+  Valor de retorno: la palabra leída.
+*/
+template <bool Profiling>
+inline Word Machine::readMemory(int dir) {
+  if constexpr (Profiling)
+    profile->reads[dir]++;
+  return data[dir];
+}
+
+template <bool Profiling>
+inline void Machine::storeMemory(int dir, Word w) {
+  if constexpr (Profiling)
+    profile->writes[dir]++;
+  writeMemory(dir, w);
+  lastWrite = dir;
+}
+
+/*
+  Funcion que realiza la operacion CLA y pone en 0 el acumulador.
+  Parametros: Ninguno.
+  Valor de retorno: Ninguno.
+*/
+void Machine::opCLA() {
+ 	 AC = Word::fromValue(0);
+  displayChanges();
+}
+
+/*
+  Funcion que realiza la operacion LDA.
+  de memoria.
+  Parametros: el tipo de direccionamiento y el parametro de la instruccion ([IR]2-0).
+  Valor de retorno: ninguno.
+*/
+template <bool Profiling>
+void Machine::opLDA(int iDireccionamiento, int iExtra) {
+  switch (iDireccionamiento) {
+    // Absoluto
+    case 1: {
+     	MAR = iExtra;
+      displayChanges();
+      MDR = readMemory<Profiling>(MAR); // MMRead
+      displayChanges(MO_READ);
+      AC = MDR;
+      displayChanges();
+      break;
+    }
+    // Indirecto
+    case 2: {
+    	MAR = iExtra;
+      displayChanges();
+      MDR = readMemory<Profiling>(MAR); // MMRead
+      displayChanges(MO_READ);
+      MAR = MDR.value();
+      displayChanges();
+      if (MAR < 0 || MAR >= MEMSIZE) {
+        reportError("OUT OF BOUNDS");
+        break;
+      }
+      MDR = readMemory<Profiling>(MAR); // MMRead
+      displayChanges(MO_READ);
+      AC = MDR;
+      displayChanges();
+      break;
+    }
+    // Inmediato
+    case 3: {
+      AC = Word::fromValue(iExtra);
+      displayChanges();
+      break;
+    }
+    // Relativo
+    case 4: {
+      if (PC + iExtra < 0 || PC + iExtra >= MEMSIZE) {
+       	reportError("OUT OF BOUNDS");
+      }
+      else {
+        MAR = PC + iExtra;
+        displayChanges();
+        MDR = readMemory<Profiling>(MAR); // MMRead
+        displayChanges(MO_READ);
+        AC = MDR;
+        displayChanges();
+      }
+      break;
+    }
+    default: {
+     	reportError("INSTRUCCION NO VALIDA");
+    }
+  }
+}
+
+/*
+  Funcion que realiza la operacion STA.
+  Parametros: el tipo de direccionamiento y el parametro de la instruccion ([IR]2-0).
+  Valor de retorno: ninguno.
+*/
+template <bool Profiling>
+void Machine::opSTA(int iDireccionamiento, int iExtra) {
+  switch (iDireccionamiento) {
+    // Absoluto
+    case 1: {
+     	MAR = iExtra;
+      displayChanges();
+      MDR = AC;
       displayChanges();
-      iDir = atoi(MAR.c_str());
-      MDR = data[iDir]; // MMRead
+      storeMemory<Profiling>(MAR, MDR); // MMWrite
+      displayChanges(MO_WRITE);
+      break;
+    }
+    // Indirecto
+    case 2: {
+    	MAR = iExtra;
+      displayChanges();
+      MDR = readMemory<Profiling>(MAR); // MMRead
+      displayChanges(MO_READ);
+      MAR = MDR.value();
+      displayChanges();
+      if (MAR < 0 || MAR >= MEMSIZE) {
+        reportError("OUT OF BOUNDS");
+        break;
+      }
+      MDR = AC;
+      displayChanges();
+      storeMemory<Profiling>(MAR, MDR); // MMWrite
+      displayChanges(MO_WRITE);
+      break;
+    }
+    // Relativo
+    case 4: {
+      if (PC + iExtra < 0 || PC + iExtra >= MEMSIZE) {
+       	reportError("OUT OF BOUNDS");
+      }
+      else {
+        MAR = PC + iExtra;
+        displayChanges();
+        MDR = AC;
+        displayChanges();
+        storeMemory<Profiling>(MAR, MDR); // MMWrite
+        displayChanges(MO_WRITE);
+      }
+      break;
+    }
+    default: {
+     	reportError("INSTRUCCION NO VALIDA");
+    }
+  }
+}
+
+/*
+  Funcion que suma o resta al acumulador un valor y guarda el resultado si no hay overflow.
+  Parametros: el valor por sumar (negativo para restar).
+  Valor de retorno: ninguno.
+*/
+void Machine::addToAC(int iValor) {
+  int iResult = AC.value() + iValor;
+  if (iResult > MAXVALUE || iResult < -MAXVALUE) {
+   	reportError("OVERFLOW");
+  }
+  else {
+    AC = Word::fromValue(iResult);
+    displayChanges();
+  }
+}
+
+/*
+  Funcion que realiza la operacion ADD.
+  Parametros: el tipo de direccionamiento y el parametro de la instruccion ([IR]2-0).
+  Valor de retorno: ninguno.
+*/
+template <bool Profiling>
+void Machine::opADD(int iDireccionamiento, int iExtra) {
+  switch (iDireccionamiento) {
+    // Absoluto
+    case 1: {
+     	MAR = iExtra;
       displayChanges();
-      iTemp = atoi(MDR.c_str());
-      iTemp2 = atoi(AC.c_str());
-      if (iTemp + iTemp2 > 99999 || iTemp + iTemp2 < -99999) {
-       	cout << "OVERFLOW" << endl;
+      MDR = readMemory<Profiling>(MAR); // MMRead
+      displayChanges(MO_READ);
+      addToAC(MDR.value());
+      break;
+    }
+    // Indirecto
+    case 2: {
+    	MAR = iExtra;
+      displayChanges();
+      MDR = readMemory<Profiling>(MAR); // MMRead
+      displayChanges(MO_READ);
+      MAR = MDR.value();
+      displayChanges();
+      if (MAR < 0 || MAR >= MEMSIZE) {
+        reportError("OUT OF BOUNDS");
+        break;
+      }
+      MDR = readMemory<Profiling>(MAR); // MMRead
+      displayChanges(MO_READ);
+      addToAC(MDR.value());
+      break;
+    }
+    // Inmediato
+    case 3: {
+      addToAC(iExtra);
+      break;
+    }
+    // Relativo
+    case 4: {
+      if (PC + iExtra < 0 || PC + iExtra >= MEMSIZE) {
+       	reportError("OUT OF BOUNDS");
+      }
+      else {
+        MAR = PC + iExtra;
+        displayChanges();
+        MDR = readMemory<Profiling>(MAR); // MMRead
+        displayChanges(MO_READ);
+        addToAC(MDR.value());
+      }
+      break;
+    }
+    default: {
+     	reportError("INSTRUCCION NO VALIDA");
+    }
+  }
+}
+
+/*
+  Funcion que realiza la operacion SUB.
+  Parametros: el tipo de direccionamiento y el parametro de la instruccion ([IR]2-0).
+  Valor de retorno: ninguno.
+*/
+template <bool Profiling>
+void Machine::opSUB(int iDireccionamiento, int iExtra) {
+  switch (iDireccionamiento) {
+    // Absoluto
+    case 1: {
+     	MAR = iExtra;
+      displayChanges();
+      MDR = readMemory<Profiling>(MAR); // MMRead
+      displayChanges(MO_READ);
+      addToAC(-MDR.value());
+      break;
+    }
+    // Indirecto
+    case 2: {
+    	MAR = iExtra;
+      displayChanges();
+      MDR = readMemory<Profiling>(MAR); // MMRead
+      displayChanges(MO_READ);
+      MAR = MDR.value();
+      displayChanges();
+      if (MAR < 0 || MAR >= MEMSIZE) {
+        reportError("OUT OF BOUNDS");
+        break;
+      }
+      MDR = readMemory<Profiling>(MAR); // MMRead
+      displayChanges(MO_READ);
+      addToAC(-MDR.value());
+      break;
+    }
+    // Inmediato
+    case 3: {
+      addToAC(-iExtra);
+      break;
+    }
+    // Relativo
+    case 4: {
+      if (PC + iExtra < 0 || PC + iExtra >= MEMSIZE) {
+       	reportError("OUT OF BOUNDS");
+      }
+      else {
+        MAR = PC + iExtra;
+        displayChanges();
+        MDR = readMemory<Profiling>(MAR); // MMRead
+        displayChanges(MO_READ);
+        addToAC(-MDR.value());
+      }
+      break;
+    }
+    default: {
+     	reportError("INSTRUCCION NO VALIDA");
+    }
+  }
+}
+
+/*
+  Funcion que realiza la operacion NEG.
+  Parametros: ninguno.
+  Valor de retorno: ninguno.
+*/
+void Machine::opNEG() {
+  AC = Word::fromValue(-AC.value());
+  displayChanges();
+}
+
+/*
+  Funcion que realiza la operacion JMP.
+  Parametros: ninguno.
+  Valor de retorno: ninguno.
+*/
+template <bool Profiling>
+void Machine::opJMP(int iDireccionamiento, int iExtra) {
+  switch (iDireccionamiento) {
+    // Absoluto
+    case 1: {
+      PCprev = PC;
+     	PC = iExtra;
+      displayChanges();
+      break;
+    }
+    // Indirecto
+    case 2: {
+    	MAR = iExtra;
+      displayChanges();
+      MDR = readMemory<Profiling>(MAR); // MMRead
+      displayChanges(MO_READ);
+      MAR = MDR.value();
+      displayChanges();
+      if (MAR < 0 || MAR >= MEMSIZE) {
+        reportError("OUT OF BOUNDS");
+        break;
+      }
+      MDR = readMemory<Profiling>(MAR); // MMRead
+      displayChanges(MO_READ);
+      PCprev = PC;
+      PC = MDR.value();
+      displayChanges();
+      break;
+    }
+    // Relativo
+    case 4: {
+      if (PC + iExtra < 0 || PC + iExtra >= MEMSIZE) {
+       	reportError("OUT OF BOUNDS");
+      }
+      else {
+        MAR = PC + iExtra;
+        displayChanges();
+        PCprev = PC;
+        PC = MAR;
+        displayChanges();
+      }
+    	break;
+		}
+    default: {
+    	reportError("INPUT ERROR");
+    }
+  }
+}
+
+/*
+  Funcion que ejecuta la instruccion a la que apunta el PC y avanza el PC.
+  Parámetros: ninguno.
+  Con Profiling = true cuenta la instrucción y sus microoperaciones en el perfil.
+  Valor de retorno: false si la instruccion ejecutada fue HLT, true en otro caso.
+*/
+template <bool Profiling>
+bool Machine::executeStep() {
+  const DecodedInst &inst = decoded[PC];
+  int iOpCode = inst.opCode, iAdType = inst.addrType, iExtra = inst.param;
+  int iDir = PC;
+  long long iMicroops = microops;
+  bool bContinue = true;
+
+  IR = data[PC];
+  steps++;
+
+  if (iOpCode != NOTINST) {
+    if (iOpCode != 7) {
+      PCprev = PC++;
+    }
+
+    switch (iOpCode) {
+      // NOP
+      case 0:
+        // JEJE SOY UN NOP e.e
+        break;
+      // CLA
+      case 1:
+        opCLA();
+        break;
+      // LDA
+      case 2:
+        opLDA<Profiling>(iAdType, iExtra);
+        break;
+      // STA
+      case 3:
+        opSTA<Profiling>(iAdType, iExtra);
+        break;
+      // ADD
+      case 4:
+        opADD<Profiling>(iAdType, iExtra);
+        break;
+      // SUB
+      case 5:
+        opSUB<Profiling>(iAdType, iExtra);
+        break;
+      // NEG
+      case 6:
+        opNEG();
+        break;
+      // JMP
+      case 7:
+        opJMP<Profiling>(iAdType, iExtra);
+        break;
+      // HLT
+      case 8:
+        displayChanges();
+        bContinue = false;
+        break;
+    }
+  }
+  else {
+   PCprev = PC++;
+  }
+
+  if constexpr (Profiling)
+    profile->count(iDir, iOpCode, iAdType, microops - iMicroops);
+
+  return bContinue;
+}
+
+/*
+  Funcion que ejecuta las instrucciones que se encuentren en la memoria
+  Parámetros: ninguno.
+  Valor de retorno: ninguno.
+*/
+void Machine::execute() {
+  PC = 0;
+  PCprev = 0;
+  steps = 0;
+  animate(0);
+}
+
+/*
+  Funcion que ejecuta con la animación de las microoperaciones desde el estado actual de los registros
+  (desde el principio o desde donde se detuvo la ejecución hasta un punto de interrupción).
+  Parámetros: el número de instrucciones por ejecutar (0 para ejecutar hasta el final).
+  Valor de retorno: false si el programa terminó.
+*/
+bool Machine::animate(long long maxSteps) {
+  bool bContinue = true;
+  long long limit = maxSteps > 0 ? steps + maxSteps : LLONG_MAX;
+  lastWrite = -1;
+  animation.start(*this);
+  pacer.reset();
+  displayChanges();
+
+
+  while (PC >= 0 && PC < MEMSIZE && bContinue && steps < limit) {
+    if(history) {
+      recordStep();
+      history->recording = true;
+    }
+    bContinue = profile ? executeStep<true>() : executeStep<false>();
+    if(history)
+      history->recording = false;
+  }
+
+  animation.finish(*this);
+  return bContinue && PC >= 0 && PC < MEMSIZE;
+}
+
+/*
+  Perfil de ejecución: con un perfil en la máquina (sim.profile o --profile), el motor clásico cuenta cuántas
+  veces se ejecuta cada dirección, cada operación y cada tipo de direccionamiento, cuántas microoperaciones hace
+  cada instrucción y cuántas veces se lee y escribe cada celda. El reporte termina con un mapa de calor de la
+  memoria con la misma cuadrícula que showMemory() (100 renglones de 10 celdas; con más de 1000 celdas cada
+  carácter agrupa MEMSIZE / 1000): a la izquierda las ejecuciones y a la derecha los accesos (lecturas y
+  escrituras), en escala logarítmica.
+*/
+
+// Direcciones que se listan en el reporte del perfil.
+#define PROFILETOP 20
+
+// Niveles del mapa de calor, de ninguna a la máxima cantidad.
+const char heatLevels[] = " .:-=+*#%@";
+
+// Función que obtiene el carácter del mapa de calor de un contador.
+// Parámetros: el contador y el máximo del mapa.
+// Valor de retorno: el carácter.
+char heatChar(long long count, long long maxCount) {
+  if (count <= 0)
+    return heatLevels[0];
+  if (maxCount <= 1)
+    return heatLevels[9];
+  return heatLevels[1 + min(8, (int) lround(8 * log((double) count) / log((double) maxCount)))];
+}
+
+// Función que escribe una lista de las celdas con más cuentas.
+// Parámetros: el flujo, el título, la cuenta de cada celda, la máquina y su perfil.
+// Valor de retorno: ninguno.
+void writeProfileTop(ostream &out, string title, const vector<long long> &counts, const Machine &machine,
+                     const Profile &profile) {
+  vector<int> order;
+  for (int i = 0; i < MEMSIZE; i++) {
+    if (counts[i] > 0)
+      order.push_back(i);
+  }
+  stable_sort(order.begin(), order.end(), [&counts](int a, int b) { return counts[a] > counts[b]; });
+  if (order.size() > PROFILETOP)
+    order.resize(PROFILETOP);
+
+  out << title << endl;
+  out << "  DIR   ejecuciones  microops  lecturas  escrituras  contenido" << endl;
+  for (size_t k = 0; k < order.size(); k++) {
+    int i = order[k];
+    out << "  " << completePC(i) << setw(14) << profile.execs[i] << setw(10) << profile.microops[i]
+        << setw(10) << profile.reads[i] << setw(12) << profile.writes[i] << "  " << machine.data[i];
+    if (machine.data[i].isInstruction())
+      out << "  " << convertAssemb(machine.data[i]);
+    out << endl;
+  }
+  out << endl;
+}
+
+/*
+  Funcion que escribe el reporte del perfil de la última ejecución.
+  Parámetros: el flujo de salida.
+  Valor de retorno: ninguno.
+*/
+void Machine::writeProfile(ostream &out) {
+  const Profile &p = *profile;
+  long long totalExecs = 0, totalMicroops = 0;
+  for (int op = 0; op <= PROFILEDATA; op++) {
+    totalExecs += p.opExecs[op];
+    totalMicroops += p.opMicroops[op];
+  }
+
+  out << "PERFIL DE EJECUCION: " << totalExecs << " instrucciones, " << totalMicroops << " microoperaciones" << endl << endl;
+
+  out << "Por operación:" << endl;
+  out << "  OP     ejecuciones        %  microops  microops/instr" << endl;
+  for (int op = 0; op <= PROFILEDATA; op++) {
+    if (p.opExecs[op] == 0)
+      continue;
+    string name = op == PROFILEDATA ? "(dato)" : op < 9 ? codes[op] : "op " + toString(op);
+    out << "  " << left << setw(6) << setfill(' ') << name << right << setw(12) << p.opExecs[op]
+        << fixed << setprecision(1) << setw(9) << 100.0 * p.opExecs[op] / totalExecs
+        << setw(10) << p.opMicroops[op] << setprecision(2) << setw(16) << double(p.opMicroops[op]) / p.opExecs[op] << endl;
+  }
+  out << endl;
+
+  const char *modeNames[5] = {"ninguno", "ABS", "IND", "INM", "REL"};
+  out << "Por direccionamiento:" << endl;
+  for (int m = 0; m < 5; m++) {
+    if (p.modeExecs[m] > 0)
+      out << "  " << left << setw(8) << modeNames[m] << right << setw(12) << p.modeExecs[m] << endl;
+  }
+  out << endl;
+
+  vector<long long> execs(p.execs, p.execs + MEMSIZE), accesses(MEMSIZE);
+  for (int i = 0; i < MEMSIZE; i++)
+    accesses[i] = p.reads[i] + p.writes[i];
+  writeProfileTop(out, "Direcciones más ejecutadas:", execs, *this, p);
+  writeProfileTop(out, "Celdas más leídas y escritas:", accesses, *this, p);
+
+  // El mapa tiene siempre a lo más 100 renglones de 10 caracteres: con más de 1000 celdas cada carácter
+  // suma las cuentas de MEMSIZE / 1000 celdas seguidas.
+  int perChar = max(1, MEMSIZE / 1000), chars = MEMSIZE / perChar;
+  vector<long long> execHeat(chars), accessHeat(chars);
+  long long maxExecs = 0, maxAccesses = 0;
+  for (int i = 0; i < MEMSIZE; i++) {
+    execHeat[i / perChar] += execs[i];
+    accessHeat[i / perChar] += accesses[i];
+  }
+  for (int c = 0; c < chars; c++) {
+    maxExecs = max(maxExecs, execHeat[c]);
+    maxAccesses = max(maxAccesses, accessHeat[c]);
+  }
+
+  out << "Mapa de calor (ejecuciones | accesos; \"" << heatLevels + 1 << "\" de menos a más";
+  if (perChar > 1)
+    out << "; cada carácter son " << perChar << " celdas";
+  out << "):" << endl;
+  out << string(ADDRDIGITS + 2, ' ') << "0123456789   0123456789" << endl;
+  for (int c = 0; c < chars; c += 10) {
+    out << setw(ADDRDIGITS) << setfill('0') << c * perChar << "  ";
+    for (int j = c; j < c + 10; j++)
+      out << heatChar(execHeat[j], maxExecs);
+    out << " | ";
+    for (int j = c; j < c + 10; j++)
+      out << heatChar(accessHeat[j], maxAccesses);
+    out << endl;
+  }
+  out << setfill(' ');
+}
+
+/*
+  Funciones auxiliares de los motores rápidos. Hacen lo mismo que las operaciones opXXX,
+  pero sin mostrar las microoperaciones.
+*/
+
+// Resuelve el direccionamiento indirecto: MAR = [p], MDR = data[p], MAR = MDR.
+// Regresa false (y reporta el error) si la dirección resultante está fuera de la memoria.
+inline bool Machine::resolveIndirect(int p) {
+  MAR = p;
+  MDR = data[MAR];
+  MAR = MDR.value();
+  if (MAR < 0 || MAR >= MEMSIZE) {
+    reportError("OUT OF BOUNDS");
+    return false;
+  }
+  return true;
+}
+
+// Resuelve el direccionamiento relativo: MAR = PC + p.
+// Regresa false (y reporta el error) si la dirección está fuera de la memoria.
+inline bool Machine::resolveRelative(int p) {
+  if (PC + p < 0 || PC + p >= MEMSIZE) {
+    reportError("OUT OF BOUNDS");
+    return false;
+  }
+  MAR = PC + p;
+  return true;
+}
+
+// Suma un valor al acumulador si el resultado no causa overflow.
+inline void Machine::accumulate(int iValor) {
+  int iResult = AC.value() + iValor;
+  if (iResult > MAXVALUE || iResult < -MAXVALUE)
+    reportError("OVERFLOW");
+  else
+    AC = Word::fromValue(iResult);
+}
+
+/*
+  Manejadores de los motores rápidos. Reciben el parametro de la instruccion ([IR]2-0)
+  y regresan false sólo cuando la instrucción es HLT.
+*/
+inline bool Machine::hSKIP(int) { PCprev = PC++; return true; }
+inline bool Machine::hNOP(int) { PCprev = PC++; return true; }
+inline bool Machine::hCLA(int) { PCprev = PC++; AC = Word::fromValue(0); return true; }
+
+inline bool Machine::hLDA_ABS(int p) { PCprev = PC++; MAR = p; MDR = data[MAR]; AC = MDR; return true; }
+inline bool Machine::hLDA_IND(int p) { PCprev = PC++; if (resolveIndirect(p)) { MDR = data[MAR]; AC = MDR; } return true; }
+inline bool Machine::hLDA_INM(int p) { PCprev = PC++; AC = Word::fromValue(p); return true; }
+inline bool Machine::hLDA_REL(int p) { PCprev = PC++; if (resolveRelative(p)) { MDR = data[MAR]; AC = MDR; } return true; }
+
+inline bool Machine::hSTA_ABS(int p) { PCprev = PC++; MAR = p; MDR = AC; writeMemory(MAR, MDR); return true; }
+inline bool Machine::hSTA_IND(int p) { PCprev = PC++; if (resolveIndirect(p)) { MDR = AC; writeMemory(MAR, MDR); } return true; }
+inline bool Machine::hSTA_REL(int p) { PCprev = PC++; if (resolveRelative(p)) { MDR = AC; writeMemory(MAR, MDR); } return true; }
+
+inline bool Machine::hADD_ABS(int p) { PCprev = PC++; MAR = p; MDR = data[MAR]; accumulate(MDR.value()); return true; }
+inline bool Machine::hADD_IND(int p) { PCprev = PC++; if (resolveIndirect(p)) { MDR = data[MAR]; accumulate(MDR.value()); } return true; }
+inline bool Machine::hADD_INM(int p) { PCprev = PC++; accumulate(p); return true; }
+inline bool Machine::hADD_REL(int p) { PCprev = PC++; if (resolveRelative(p)) { MDR = data[MAR]; accumulate(MDR.value()); } return true; }
+
+inline bool Machine::hSUB_ABS(int p) { PCprev = PC++; MAR = p; MDR = data[MAR]; accumulate(-MDR.value()); return true; }
+inline bool Machine::hSUB_IND(int p) { PCprev = PC++; if (resolveIndirect(p)) { MDR = data[MAR]; accumulate(-MDR.value()); } return true; }
+inline bool Machine::hSUB_INM(int p) { PCprev = PC++; accumulate(-p); return true; }
+inline bool Machine::hSUB_REL(int p) { PCprev = PC++; if (resolveRelative(p)) { MDR = data[MAR]; accumulate(-MDR.value()); } return true; }
+
+inline bool Machine::hNEG(int) { PCprev = PC++; AC = Word::fromValue(-AC.value()); return true; }
+
+inline bool Machine::hJMP_ABS(int p) { PCprev = PC; PC = p; return true; }
+inline bool Machine::hJMP_IND(int p) { if (resolveIndirect(p)) { MDR = data[MAR]; PCprev = PC; PC = MDR.value(); } return true; }
+inline bool Machine::hJMP_REL(int p) { if (resolveRelative(p)) { PCprev = PC; PC = MAR; } return true; }
+
+inline bool Machine::hHLT(int) { PCprev = PC++; return false; }
+inline bool Machine::hINVALID(int) { PCprev = PC++; reportError("INSTRUCCION NO VALIDA"); return true; }
+inline bool Machine::hJMP_INVALID(int) { reportError("INPUT ERROR"); return true; }
+// Punto de interrupción: no ejecuta la instrucción, deshace el paso y detiene el motor en el siguiente despacho.
+inline bool Machine::hBREAK(int) { steps--; stepLimit = steps; breakReason = BREAK_ADDRESS; return true; }
+
+/*
+  Superinstrucciones: ejecutan la secuencia completa con un solo despacho, avanzando IR y el contador
+  de pasos por cada instrucción como si se hubieran despachado por separado. Si no quedan pasos
+  suficientes antes del límite se ejecuta sólo la primera instrucción.
+  Si un salto llega a la mitad de la secuencia se ejecuta la instrucción de esa celda normalmente,
+  y si STA modifica alguna celda de la secuencia writeMemory() la vuelve a revisar.
+*/
+inline void Machine::nextInSequence() {
+  IR = data[PC];
+  steps++;
+}
+
+inline bool Machine::hLDA_ADD_STA(int p) {
+  if (stepLimit - steps < 2)
+    return hLDA_ABS(p);
+  hLDA_ABS(p);
+  nextInSequence();
+  hADD_ABS(decoded[PC].param);
+  nextInSequence();
+  return hSTA_ABS(decoded[PC].param);
+}
+
+inline bool Machine::hLDA_SUB_STA(int p) {
+  if (stepLimit - steps < 2)
+    return hLDA_ABS(p);
+  hLDA_ABS(p);
+  nextInSequence();
+  hSUB_ABS(decoded[PC].param);
+  nextInSequence();
+  return hSTA_ABS(decoded[PC].param);
+}
+
+inline bool Machine::hLDA_ADDI_STA(int p) {
+  if (stepLimit - steps < 2)
+    return hLDA_ABS(p);
+  hLDA_ABS(p);
+  nextInSequence();
+  hADD_INM(decoded[PC].param);
+  nextInSequence();
+  return hSTA_ABS(decoded[PC].param);
+}
+
+inline bool Machine::hCLA_ADDI(int p) {
+  if (stepLimit - steps < 1)
+    return hCLA(p);
+  hCLA(p);
+  nextInSequence();
+  return hADD_INM(decoded[PC].param);
+}
+
+// Tabla de manejadores en el mismo orden que HandlerId.
+const Machine::Handler Machine::handlers[HANDLERCOUNT] = {
+  call<&Machine::hSKIP>, call<&Machine::hNOP>, call<&Machine::hCLA>,
+  call<&Machine::hLDA_ABS>, call<&Machine::hLDA_IND>, call<&Machine::hLDA_INM>, call<&Machine::hLDA_REL>,
+  call<&Machine::hSTA_ABS>, call<&Machine::hSTA_IND>, call<&Machine::hSTA_REL>,
+  call<&Machine::hADD_ABS>, call<&Machine::hADD_IND>, call<&Machine::hADD_INM>, call<&Machine::hADD_REL>,
+  call<&Machine::hSUB_ABS>, call<&Machine::hSUB_IND>, call<&Machine::hSUB_INM>, call<&Machine::hSUB_REL>,
+  call<&Machine::hNEG>,
+  call<&Machine::hJMP_ABS>, call<&Machine::hJMP_IND>, call<&Machine::hJMP_REL>,
+  call<&Machine::hHLT>, call<&Machine::hINVALID>, call<&Machine::hJMP_INVALID>,
+  call<&Machine::hBREAK>,
+  call<&Machine::hLDA_ADD_STA>, call<&Machine::hLDA_SUB_STA>, call<&Machine::hLDA_ADDI_STA>, call<&Machine::hCLA_ADDI>
+};
+
+/*
+  Motor de tabla: cada paso es una búsqueda en decoded[] y una llamada indirecta al manejador.
+  Parámetros: el limite de instrucciones por ejecutar (0 para no tener limite).
+  Valor de retorno: el motivo por el que termino la ejecucion.
+*/
+string Machine::runTable(long long maxSteps) {
+  stepLimit = maxSteps > 0 ? maxSteps : LLONG_MAX;
+
+  while ((unsigned) PC < MEMSIZE) {
+    if (steps >= stepLimit)
+      return "step_limit";
+    const DecodedInst &inst = decoded[PC];
+    IR = data[PC];
+    steps++;
+    if (!handlers[inst.handler](*this, inst.param))
+      return "halted";
+  }
+
+  return "end_of_memory";
+}
+
+/*
+  Motor de goto calculado (extensión de GCC/Clang): cada manejador termina saltando directamente
+  al siguiente, así que cada instrucción cuesta un solo salto indirecto.
+  Con otros compiladores se usa el motor de tabla.
+  Parámetros: el limite de instrucciones por ejecutar (0 para no tener limite).
+  Valor de retorno: el motivo por el que termino la ejecucion.
+*/
+string Machine::runGoto(long long maxSteps) {
+#if defined(__GNUC__)
+  // Etiquetas en el mismo orden que HandlerId.
+  static void *labels[HANDLERCOUNT] = {
+    &&L_SKIP, &&L_NOP, &&L_CLA,
+    &&L_LDA_ABS, &&L_LDA_IND, &&L_LDA_INM, &&L_LDA_REL,
+    &&L_STA_ABS, &&L_STA_IND, &&L_STA_REL,
+    &&L_ADD_ABS, &&L_ADD_IND, &&L_ADD_INM, &&L_ADD_REL,
+    &&L_SUB_ABS, &&L_SUB_IND, &&L_SUB_INM, &&L_SUB_REL,
+    &&L_NEG,
+    &&L_JMP_ABS, &&L_JMP_IND, &&L_JMP_REL,
+    &&L_HLT, &&L_INVALID, &&L_JMP_INVALID,
+    &&L_BREAK,
+    &&L_LDA_ADD_STA, &&L_LDA_SUB_STA, &&L_LDA_ADDI_STA, &&L_CLA_ADDI
+  };
+  stepLimit = maxSteps > 0 ? maxSteps : LLONG_MAX;
+  const DecodedInst *inst;
+
+#define DISPATCH() \
+  if ((unsigned) PC >= MEMSIZE) return "end_of_memory"; \
+  if (steps >= stepLimit) return "step_limit"; \
+  inst = &decoded[PC]; \
+  IR = data[PC]; \
+  steps++; \
+  goto *labels[inst->handler]
+
+  DISPATCH();
+
+  L_SKIP:        hSKIP(inst->param); DISPATCH();
+  L_NOP:         hNOP(inst->param); DISPATCH();
+  L_CLA:         hCLA(inst->param); DISPATCH();
+  L_LDA_ABS:     hLDA_ABS(inst->param); DISPATCH();
+  L_LDA_IND:     hLDA_IND(inst->param); DISPATCH();
+  L_LDA_INM:     hLDA_INM(inst->param); DISPATCH();
+  L_LDA_REL:     hLDA_REL(inst->param); DISPATCH();
+  L_STA_ABS:     hSTA_ABS(inst->param); DISPATCH();
+  L_STA_IND:     hSTA_IND(inst->param); DISPATCH();
+  L_STA_REL:     hSTA_REL(inst->param); DISPATCH();
+  L_ADD_ABS:     hADD_ABS(inst->param); DISPATCH();
+  L_ADD_IND:     hADD_IND(inst->param); DISPATCH();
+  L_ADD_INM:     hADD_INM(inst->param); DISPATCH();
+  L_ADD_REL:     hADD_REL(inst->param); DISPATCH();
+  L_SUB_ABS:     hSUB_ABS(inst->param); DISPATCH();
+  L_SUB_IND:     hSUB_IND(inst->param); DISPATCH();
+  L_SUB_INM:     hSUB_INM(inst->param); DISPATCH();
+  L_SUB_REL:     hSUB_REL(inst->param); DISPATCH();
+  L_NEG:         hNEG(inst->param); DISPATCH();
+  L_JMP_ABS:     hJMP_ABS(inst->param); DISPATCH();
+  L_JMP_IND:     hJMP_IND(inst->param); DISPATCH();
+  L_JMP_REL:     hJMP_REL(inst->param); DISPATCH();
+  L_INVALID:     hINVALID(inst->param); DISPATCH();
+  L_JMP_INVALID: hJMP_INVALID(inst->param); DISPATCH();
+  L_BREAK:       hBREAK(inst->param); DISPATCH();
+  L_LDA_ADD_STA: hLDA_ADD_STA(inst->param); DISPATCH();
+  L_LDA_SUB_STA: hLDA_SUB_STA(inst->param); DISPATCH();
+  L_LDA_ADDI_STA: hLDA_ADDI_STA(inst->param); DISPATCH();
+  L_CLA_ADDI:    hCLA_ADDI(inst->param); DISPATCH();
+  L_HLT:         hHLT(inst->param); return "halted";
+
+#undef DISPATCH
+#else
+  return runTable(maxSteps);
+#endif
+}
+
+/*
+  Depuración: ejecución a toda velocidad hasta un punto de interrupción.
+
+  Los puntos de interrupción no se revisan en cada paso: su celda usa el manejador H_BREAK (fuseCell lo pone
+  en vez del de la instrucción, y no forma superinstrucciones que se lo salten), que detiene el motor sin
+  ejecutarla. Las celdas vigiladas se revisan en writeMemory() con su bit del mapa. Ambos bajan stepLimit
+  para que el motor se detenga en el siguiente despacho, así que el motor goto corre igual de rápido con o sin
+  puntos de interrupción. Vigilar el AC y guardar el historial sí necesitan cada paso: en esos casos se usa
+  el motor de tabla sin superinstrucciones (ni el AC ni los registros se ven entre las instrucciones de una
+  superinstrucción).
+*/
+
+// Función que pone o quita un punto de interrupción.
+// Parámetro: la dirección.
+// Valor de retorno: ninguno.
+void Machine::toggleBreakpoint(int dir) {
+  breakpoints[dir >> 6] ^= 1ULL << (dir & 63);
+  // La celda y las dos anteriores (que podrían formar una superinstrucción con ella) cambian de manejador.
+  decodeCell(dir);
+  for(int i = dir - 2; i <= dir; i++)
+    fuseCell(i);
+}
+
+// Función que empieza o deja de vigilar una celda.
+// Parámetro: la dirección.
+// Valor de retorno: ninguno.
+void Machine::toggleWatch(int dir) {
+  watchedCells[dir >> 6] ^= 1ULL << (dir & 63);
+}
+
+// Ejecuta la instrucción del punto de interrupción donde se detuvo, con su manejador sin H_BREAK.
+// Regresa false si era HLT.
+bool Machine::stepOver() {
+  IR = data[PC];
+  steps++;
+  return handlers[decodeWord(data[PC]).handler](*this, decoded[PC].param);
+}
+
+/*
+  Funcion que ejecuta sin animación hasta un punto de interrupción, una celda vigilada que cambia,
+  el valor vigilado del AC o el final del programa.
+  Parámetros: si la ejecución continúa desde un punto de interrupción (su instrucción sí se ejecuta).
+  Valor de retorno: string con el motivo por el que terminó ("break" si se detuvo en un punto de interrupción,
+                    breakReason dice cuál; "step_limit" después de DEBUGMAXSTEPS instrucciones sin detenerse).
+*/
+string Machine::runToBreak(bool fromBreak) {
+  long long limit = steps + DEBUGMAXSTEPS;
+  breakReason = BREAK_NONE;
+  stepLimit = limit;
+  // Los errores se guardan como en el modo sin menú y se muestran en el alto.
+  bool headless = headlessMode;
+  headlessMode = true;
+  diagnostics.clear();
+  diagnosticsCount = 0;
+
+  string status = "step_limit";
+  if(history || watchAC)
+    status = runDebugTable(fromBreak, false);
+  else if(fromBreak && PC >= 0 && PC < MEMSIZE && isBreakpoint(PC) && !stepOver())
+    status = "halted";
+  else if(breakReason == BREAK_NONE)
+    status = runGoto(limit);
+
+  if(breakReason != BREAK_NONE && status == "step_limit")
+    status = "break";
+  headlessMode = headless;
+  return status;
+}
+
+/*
+  Motor de tabla de la depuración, para cuando hay que revisar cada paso: guarda el historial y se detiene
+  cuando el AC cambia al valor vigilado.
+  Parámetros: si se ejecuta la instrucción del punto de interrupción donde empieza, y si es una repetición
+              del historial (no se detiene en los puntos de interrupción ni en el AC, sólo en stepLimit).
+  Valor de retorno: el motivo por el que terminó.
+*/
+string Machine::runDebugTable(bool fromBreak, bool replay) {
+  bool fusion = fusionEnabled;
+  if(fusion) {
+    fusionEnabled = false;
+    decodeMemory();
+  }
+
+  string status = "end_of_memory";
+  while ((unsigned) PC < MEMSIZE) {
+    // stepLimit lo pone runToBreak() (o stepBack()) y lo bajan hBREAK() y writeMemory().
+    if (steps >= stepLimit) {
+      status = "step_limit";
+      break;
+    }
+    const DecodedInst &inst = decoded[PC];
+    int handler = inst.handler;
+    if (handler == H_BREAK) {
+      if (!fromBreak && !replay) {
+        breakReason = BREAK_ADDRESS;
+        status = "step_limit";
+        break;
+      }
+      handler = decodeWord(data[PC]).handler;
+    }
+    fromBreak = false;
+
+    if (history) {
+      recordStep();
+      history->recording = true;
+    }
+    Word before = AC;
+    IR = data[PC];
+    steps++;
+    bool running = handlers[handler](*this, inst.param);
+    if (history)
+      history->recording = false;
+
+    if (!running) {
+      status = "halted";
+      break;
+    }
+    if (watchAC && !replay && AC == watchACValue && before != watchACValue && breakReason == BREAK_NONE) {
+      breakReason = BREAK_AC;
+      status = "step_limit";
+      break;
+    }
+  }
+
+  if(fusion) {
+    fusionEnabled = true;
+    decodeMemory();
+  }
+  return status;
+}
+
+// Función que guarda en el historial el cambio de la instrucción que sigue (y una instantánea si toca).
+// Parámetros: ninguno.
+// Valor de retorno: ninguno.
+void Machine::recordStep() {
+  History &h = *history;
+  // Si se ejecutó algo sin guardarlo, los cambios anteriores ya no sirven para deshacer.
+  if(h.deltaEnd != steps)
+    h.deltaFirst = h.deltaEnd = steps;
+
+  if(steps % h.interval == 0 && (h.snapshotCount == 0 || h.snapshot(h.snapshotCount - 1).steps < steps)) {
+    // Mientras el anillo no está lleno, cada instantánea nueva ocupa un lugar nuevo (snapshotFirst sigue en 0).
+    if(h.snapshotCount == h.snapshots.size() && h.snapshots.size() < h.snapshotCapacity) {
+      try {
+        h.snapshots.push_back(unique_ptr<HistorySnapshot>(new HistorySnapshot));
+      } catch(const bad_alloc &) {
+        h.snapshotCapacity = h.snapshots.size();
+      }
+    }
+    if(!h.snapshots.empty()) {
+      if(h.snapshotCount == h.snapshots.size()) {
+        h.snapshotFirst = (h.snapshotFirst + 1) % h.snapshots.size();
+        h.snapshotCount--;
+      }
+      HistorySnapshot &s = h.snapshot(h.snapshotCount++);
+      s.steps = steps;
+      s.PC = PC;
+      s.PCprev = PCprev;
+      s.MAR = MAR;
+      s.MDR = MDR;
+      s.IR = IR;
+      s.AC = AC;
+      memcpy(s.data, data, sizeof data);
+    }
+  }
+
+  HistoryDelta &d = h.delta(steps);
+  d.PC = PC;
+  d.PCprev = PCprev;
+  d.MAR = MAR;
+  d.MDR = MDR;
+  d.IR = IR;
+  d.AC = AC;
+  d.cell = -1;
+  h.deltaEnd = steps + 1;
+  if(h.deltaEnd - h.deltaFirst > (long long) h.deltas.size())
+    h.deltaFirst = h.deltaEnd - h.deltas.size();
+}
+
+/*
+  Funcion que regresa la máquina n instrucciones atrás con el historial: deshace los cambios guardados o,
+  si no alcanzan, restaura la instantánea anterior más cercana y vuelve a ejecutar desde ella.
+  Parámetros: el número de instrucciones por retroceder (se detiene en la instrucción 0).
+  Valor de retorno: false si el historial ya no llega tan atrás (la máquina no cambia).
+*/
+bool Machine::stepBack(long long n) {
+  History &h = *history;
+  long long target = max(0LL, steps - n);
+  if(h.deltaEnd != steps)
+    h.deltaFirst = h.deltaEnd = steps;
+
+  if(target >= h.deltaFirst) {
+    while(steps > target) {
+      const HistoryDelta &d = h.delta(--steps);
+      if(d.cell >= 0)
+        writeMemory(d.cell, d.old);
+      PC = d.PC;
+      PCprev = d.PCprev;
+      MAR = d.MAR;
+      MDR = d.MDR;
+      IR = d.IR;
+      AC = d.AC;
+    }
+    h.deltaEnd = steps;
+  } else {
+    size_t i = h.snapshotCount;
+    while(i > 0 && h.snapshot(i - 1).steps > target)
+      i--;
+    if(i == 0)
+      return false;
+
+    const HistorySnapshot &s = h.snapshot(i - 1);
+    memcpy(data, s.data, sizeof data);
+    decodeMemory();
+    steps = s.steps;
+    PC = s.PC;
+    PCprev = s.PCprev;
+    MAR = s.MAR;
+    MDR = s.MDR;
+    IR = s.IR;
+    AC = s.AC;
+    h.deltaFirst = h.deltaEnd = steps;
+    h.snapshotCount = i;
+
+    // Las celdas vigiladas no detienen la repetición, y sus errores ya se mostraron.
+    uint64_t watched[OCCUPIEDWORDS];
+    memcpy(watched, watchedCells, sizeof watched);
+    memset(watchedCells, 0, sizeof watchedCells);
+    bool headless = headlessMode;
+    headlessMode = true;
+    stepLimit = target;
+    runDebugTable(false, true);
+    headlessMode = headless;
+    memcpy(watchedCells, watched, sizeof watched);
+  }
+
+  // Las instantáneas posteriores se vuelven a tomar si la ejecución sigue.
+  while(h.snapshotCount > 0 && h.snapshot(h.snapshotCount - 1).steps > target)
+    h.snapshotCount--;
+  breakReason = BREAK_NONE;
+  diagnostics.clear();
+  diagnosticsCount = 0;
+  return true;
+}
+
+/*
+  Compilador JIT para Linux x86-64 (motor "jit").
+
+  Traduce bloques básicos de la memoria simulada a código nativo dentro de un buffer de mmap.
+  Un bloque empieza en una dirección y termina en un JMP (incluido), antes de HLT, de una instrucción
+  no válida o de un direccionamiento relativo fuera de la memoria, o al llegar a JITMAXBLOCK instrucciones.
+  Al terminar, un bloque salta directamente al bloque de su destino si ya está traducido.
+
+  El código nativo regresa al despachador antes de ejecutar una instrucción, que entonces se ejecuta con
+  los manejadores del motor de tabla, cuando:
+    - un operando, el acumulador o el resultado no es un dato en rango (overflow, celdas vacías o instrucciones),
+    - una dirección indirecta sale de la memoria,
+    - STA escribiría en una celda que contiene una instrucción o que ya está traducida
+      (si estaba traducida, el despachador descarta los bloques que la incluyen),
+    - no quedan pasos suficientes para el bloque completo.
+*/
+#if defined(__x86_64__) && defined(__linux__)
+
+// Registros de x86-64 usados por el código generado:
+// rdi memoria, rsi estado, rdx mapa de celdas protegidas, r8d acumulador; rax, rcx y r9 temporales.
+enum { RAX = 0, RCX = 1, RDX = 2, RSI = 6, RDI = 7, R8 = 8, R9 = 9 };
+// Condiciones de los saltos condicionales.
+enum { CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7, CC_L = 0xC };
+
+struct JitEmitter {
+  vector<uint8_t> code;
+  // Saltos hacia las salidas: posición del desplazamiento por corregir e instrucción antes de la que se sale.
+  vector<pair<size_t, int> > exits;
+
+  void byte(int b) { code.push_back((uint8_t) b); }
+  void imm32(int32_t v) { for (int i = 0; i < 4; i++) byte((v >> (8 * i)) & 0xFF); }
+  void patch32(size_t pos, int32_t v) { for (int i = 0; i < 4; i++) code[pos + i] = (v >> (8 * i)) & 0xFF; }
+
+  // Prefijo REX (sólo si hace falta, o siempre con operandos de 64 bits).
+  void rex(bool wide, int reg, int index, int base) {
+    int r = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((index & 8) ? 2 : 0) | ((base & 8) ? 1 : 0);
+    if (r != 0x40)
+      byte(r);
+  }
+  // Operando [base + disp32].
+  void memDisp(int reg, int base, int32_t disp) { byte(0x80 | ((reg & 7) << 3) | (base & 7)); imm32(disp); }
+  // Operando [base + index * 2^scale].
+  void memIndex(int reg, int base, int index, int scale) { byte(0x04 | ((reg & 7) << 3)); byte((scale << 6) | ((index & 7) << 3) | (base & 7)); }
+  void regReg(int reg, int rm) { byte(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+
+  void load(int dst, int base, int32_t disp) { rex(false, dst, 0, base); byte(0x8B); memDisp(dst, base, disp); }
+  void load64(int dst, int base, int32_t disp) { rex(true, dst, 0, base); byte(0x8B); memDisp(dst, base, disp); }
+  void store(int base, int32_t disp, int src) { rex(false, src, 0, base); byte(0x89); memDisp(src, base, disp); }
+  void storeImm(int base, int32_t disp, int32_t imm) { rex(false, 0, 0, base); byte(0xC7); memDisp(0, base, disp); imm32(imm); }
+  void loadIndex(int dst, int base, int index) { rex(false, dst, index, base); byte(0x8B); memIndex(dst, base, index, 2); }
+  void load64Index(int dst, int base, int index) { rex(true, dst, index, base); byte(0x8B); memIndex(dst, base, index, 3); }
+  void storeIndex(int base, int index, int src) { rex(false, src, index, base); byte(0x89); memIndex(src, base, index, 2); }
+  void movImm(int dst, int32_t imm) { rex(false, 0, 0, dst); byte(0xB8 + (dst & 7)); imm32(imm); }
+  void movReg(int dst, int src) { rex(false, src, 0, dst); byte(0x89); regReg(src, dst); }
+  void addReg(int dst, int src) { rex(false, src, 0, dst); byte(0x01); regReg(src, dst); }
+  void subReg(int dst, int src) { rex(false, src, 0, dst); byte(0x29); regReg(src, dst); }
+  void neg(int reg) { rex(false, 0, 0, reg); byte(0xF7); regReg(3, reg); }
+  void lea(int dst, int src, int32_t disp) { rex(false, dst, 0, src); byte(0x8D); memDisp(dst, src, disp); }
+  void cmpImm(int reg, int32_t imm) { rex(false, 0, 0, reg); byte(0x81); regReg(7, reg); imm32(imm); }
+  void cmpMem64Imm(int base, int32_t disp, int32_t imm) { rex(true, 0, 0, base); byte(0x81); memDisp(7, base, disp); imm32(imm); }
+  void subMem64Imm(int base, int32_t disp, int32_t imm) { rex(true, 0, 0, base); byte(0x81); memDisp(5, base, disp); imm32(imm); }
+  void cmpByteZero(int base, int32_t disp) { rex(false, 0, 0, base); byte(0x80); memDisp(7, base, disp); byte(0); }
+  void cmpByteZeroIndex(int base, int index) { rex(false, 0, index, base); byte(0x80); memIndex(7, base, index, 0); byte(0); }
+  void test64(int reg) { rex(true, reg, 0, reg); byte(0x85); regReg(reg, reg); }
+  void jmpReg(int reg) { rex(false, 0, 0, reg); byte(0xFF); regReg(4, reg); }
+  void ret() { byte(0xC3); }
+
+  // Salto condicional con desplazamiento de 32 bits; regresa la posición del desplazamiento.
+  size_t jcc(int cc) { byte(0x0F); byte(0x80 | cc); imm32(0); return code.size() - 4; }
+  void bindHere(size_t pos) { patch32(pos, code.size() - (pos + 4)); }
+  void jccExit(int cc, int i) { exits.push_back(make_pair(jcc(cc), i)); }
+
+  // Sale antes de la instrucción i si reg no es un dato entre lo y hi.
+  void exitIfOutside(int reg, int lo, int hi, int i) {
+    lea(R9, reg, -lo);
+    cmpImm(R9, hi - lo);
+    jccExit(CC_A, i);
+  }
+};
+
+/*
+  Funcion que reserva el buffer ejecutable del JIT.
+  Parámetros: ninguno.
+  Valor de retorno: true si el buffer está disponible.
+*/
+bool Machine::jitInit() {
+  if (jitBuffer == NULL) {
+    void *buf = mmap(NULL, JITBUFSIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED)
+      return false;
+    jitBuffer = (uint8_t *) buf;
+  }
+  return true;
+}
+
+/*
+  Funcion que descarta todas las traducciones.
+  Parámetros: ninguno.
+  Valor de retorno: ninguno.
+*/
+void Machine::jitFlush() {
+  jitUsed = 0;
+  for (int i = 0; i < MEMSIZE; i++) {
+    jitBlocks[i].fn = NULL;
+    jitBlocks[i].length = 0;
+    jitBlocks[i].tried = false;
+    jitBlocks[i].invalidations = 0;
+    jitEntries[i] = NULL;
+    jitCovered[i] = 0;
+    jitCodeMap[i] = decoded[i].opCode != NOTINST;
+  }
+}
+
+/*
+  Funcion que descarta los bloques traducidos que incluyen una celda que STA acaba de modificar.
+  Un bloque descartado JITMAXINVALIDATIONS veces ya no se traduce (su código se modifica a sí mismo)
+  y sus instrucciones las ejecuta el despachador.
+  Parámetros: la dirección de la celda modificada.
+  Valor de retorno: ninguno.
+*/
+void Machine::jitInvalidate(int dir) {
+  for (int s = max(0, dir - JITMAXBLOCK + 1); s <= dir; s++) {
+    JitBlockInfo &block = jitBlocks[s];
+    if (block.fn == NULL || s + block.length <= dir)
+      continue;
+    for (int k = s; k < s + block.length; k++) {
+      jitCovered[k]--;
+      jitCodeMap[k] = jitCovered[k] > 0 || decoded[k].opCode != NOTINST;
+    }
+    block.fn = NULL;
+    block.length = 0;
+    block.tried = ++block.invalidations >= JITMAXINVALIDATIONS;
+    jitEntries[s] = NULL;
+  }
+}
+
+// Emite la salida hacia el destino fijo t al terminar un bloque de n instrucciones,
+// saltando directamente al bloque de t si ya está traducido.
+void Machine::jitEmitEnd(JitEmitter &e, const vector<int> &addrs, int t) {
+  int n = addrs.size();
+  e.storeImm(RSI, JS_PCPREV, addrs[n - 1]);
+  e.storeImm(RSI, JS_IR, data[addrs[n - 1]].bits);
+  e.subMem64Imm(RSI, JS_REMAINING, n);
+  if (t >= 0 && t < MEMSIZE) {
+    e.load64(RAX, RSI, JS_ENTRIES);
+    e.load64(RAX, RAX, t * 8);
+    e.test64(RAX);
+    size_t notTranslated = e.jcc(CC_E);
+    e.jmpReg(RAX);
+    e.bindHere(notTranslated);
+  }
+  e.store(RSI, JS_AC, R8);
+  e.storeImm(RSI, JS_PC, t);
+  e.movImm(RAX, 0);
+  e.ret();
+}
+
+// Emite la salida hacia el destino en ecx (JMP IND) al terminar un bloque de n instrucciones.
+void Machine::jitEmitEndIndirect(JitEmitter &e, const vector<int> &addrs) {
+  int n = addrs.size();
+  e.storeImm(RSI, JS_PCPREV, addrs[n - 1]);
+  e.storeImm(RSI, JS_IR, data[addrs[n - 1]].bits);
+  e.subMem64Imm(RSI, JS_REMAINING, n);
+  e.cmpImm(RCX, MEMSIZE - 1);
+  size_t outside = e.jcc(CC_A);
+  e.load64(RAX, RSI, JS_ENTRIES);
+  e.load64Index(RAX, RAX, RCX);
+  e.test64(RAX);
+  size_t notTranslated = e.jcc(CC_E);
+  e.jmpReg(RAX);
+  e.bindHere(outside);
+  e.bindHere(notTranslated);
+  e.store(RSI, JS_AC, R8);
+  e.store(RSI, JS_PC, RCX);
+  e.movImm(RAX, 0);
+  e.ret();
+}
+
+// Emite la resolución del direccionamiento indirecto: eax = data[p], que debe ser una dirección válida.
+static void jitEmitIndirect(JitEmitter &e, int p, int i) {
+  e.load(RAX, RDI, p * 4);
+  e.cmpImm(RAX, MEMSIZE - 1);
+  e.jccExit(CC_A, i);
+  e.store(RSI, JS_MAR, RAX);
+}
+
+// Emite la suma (o resta) del operando en ecx al acumulador, saliendo si algo no es un dato o hay overflow.
+static void jitEmitArith(JitEmitter &e, bool add, int i) {
+  e.exitIfOutside(RCX, -MAXVALUE, MAXVALUE, i);
+  e.exitIfOutside(R8, -MAXVALUE, MAXVALUE, i);
+  e.movReg(RAX, R8);
+  if (add)
+    e.addReg(RAX, RCX);
+  else
+    e.subReg(RAX, RCX);
+  e.exitIfOutside(RAX, -MAXVALUE, MAXVALUE, i);
+  e.movReg(R8, RAX);
+}
+
+/*
+  Funcion que traduce el bloque que empieza en una dirección y lo copia al buffer ejecutable.
+  Parámetros: la dirección inicial del bloque.
+  Valor de retorno: ninguno (si no se puede traducir ninguna instrucción el bloque queda sin código).
+*/
+void Machine::jitTranslate(int start) {
+  JitEmitter e;
+  vector<int> addrs;
+  int a = start;
+  bool ended = false;
+
+  jitBlocks[start].tried = true;
+
+  // Entrada desde el despachador: carga el acumulador. Entrada desde otro bloque: revisa los pasos restantes.
+  e.load(R8, RSI, JS_AC);
+  size_t chainEntry = e.code.size();
+  e.cmpMem64Imm(RSI, JS_REMAINING, 0);
+  size_t budgetPos = e.code.size() - 4;
+  e.jccExit(CC_L, 0);
+
+  while (a < MEMSIZE && (int) addrs.size() < JITMAXBLOCK && !ended) {
+    const DecodedInst &d = decoded[a];
+    int h = d.opCode == NOTINST ? H_SKIP : getHandler(d.opCode, d.addrType);
+    int p = d.param, i = addrs.size();
+    int t = p;
+
+    // El relativo usa el PC ya incrementado, excepto en JMP. Fuera de la memoria lo reporta el despachador.
+    bool relative = h == H_LDA_REL || h == H_STA_REL || h == H_ADD_REL || h == H_SUB_REL || h == H_JMP_REL;
+    if (relative)
+      t = h == H_JMP_REL ? a + p : a + 1 + p;
+    if (relative && (t < 0 || t >= MEMSIZE))
+      break;
+
+    switch (h) {
+      case H_SKIP:
+      case H_NOP:
+        break;
+      case H_CLA:
+        e.movImm(R8, 0);
+        break;
+      case H_NEG:
+        e.exitIfOutside(R8, -MAXVALUE, MAXVALUE, i);
+        e.neg(R8);
+        break;
+      case H_LDA_ABS:
+      case H_LDA_REL:
+        e.load(RAX, RDI, t * 4);
+        e.storeImm(RSI, JS_MAR, t);
+        e.store(RSI, JS_MDR, RAX);
+        e.movReg(R8, RAX);
+        break;
+      case H_LDA_IND:
+        jitEmitIndirect(e, p, i);
+        e.loadIndex(RCX, RDI, RAX);
+        e.store(RSI, JS_MDR, RCX);
+        e.movReg(R8, RCX);
+        break;
+      case H_LDA_INM:
+        e.movImm(R8, p);
+        break;
+      case H_STA_ABS:
+      case H_STA_REL:
+        e.exitIfOutside(R8, -MAXVALUE, MAXVALUE, i);
+        e.cmpByteZero(RDX, t);
+        e.jccExit(CC_NE, i);
+        e.storeImm(RSI, JS_MAR, t);
+        e.store(RSI, JS_MDR, R8);
+        e.store(RDI, t * 4, R8);
+        break;
+      case H_STA_IND:
+        jitEmitIndirect(e, p, i);
+        e.exitIfOutside(R8, -MAXVALUE, MAXVALUE, i);
+        e.cmpByteZeroIndex(RDX, RAX);
+        e.jccExit(CC_NE, i);
+        e.store(RSI, JS_MDR, R8);
+        e.storeIndex(RDI, RAX, R8);
+        break;
+      case H_ADD_ABS:
+      case H_ADD_REL:
+      case H_SUB_ABS:
+      case H_SUB_REL:
+        e.load(RCX, RDI, t * 4);
+        e.storeImm(RSI, JS_MAR, t);
+        e.store(RSI, JS_MDR, RCX);
+        jitEmitArith(e, h == H_ADD_ABS || h == H_ADD_REL, i);
+        break;
+      case H_ADD_IND:
+      case H_SUB_IND:
+        jitEmitIndirect(e, p, i);
+        e.loadIndex(RCX, RDI, RAX);
+        e.store(RSI, JS_MDR, RCX);
+        jitEmitArith(e, h == H_ADD_IND, i);
+        break;
+      case H_ADD_INM:
+      case H_SUB_INM:
+        e.movImm(RCX, p);
+        jitEmitArith(e, h == H_ADD_INM, i);
+        break;
+      case H_JMP_ABS:
+      case H_JMP_REL:
+        if (h == H_JMP_REL)
+          e.storeImm(RSI, JS_MAR, t);
+        addrs.push_back(a);
+        jitEmitEnd(e, addrs, t);
+        ended = true;
+        break;
+      case H_JMP_IND:
+        jitEmitIndirect(e, p, i);
+        e.loadIndex(RCX, RDI, RAX);
+        e.store(RSI, JS_MDR, RCX);
+        e.exitIfOutside(RCX, -MAXVALUE, MAXVALUE, i);
+        addrs.push_back(a);
+        jitEmitEndIndirect(e, addrs);
+        ended = true;
+        break;
+      default:
+        // HLT e instrucciones no válidas las ejecuta el despachador.
+        ended = true;
+        continue;
+    }
+
+    if (!ended) {
+      addrs.push_back(a);
+      a++;
+    }
+  }
+
+  int n = addrs.size();
+  if (n == 0)
+    return;
+
+  // Un bloque que no termina en JMP continúa en la siguiente dirección.
+  if (!ended || decoded[addrs[n - 1]].opCode != 7)
+    jitEmitEnd(e, addrs, a);
+
+  e.patch32(budgetPos, n);
+
+  // Salidas hacia el despachador, una por instrucción antes de la que se puede salir.
+  vector<size_t> stubs(n, 0);
+  for (size_t k = 0; k < e.exits.size(); k++) {
+    int i = e.exits[k].second;
+    if (stubs[i] == 0) {
+      stubs[i] = e.code.size();
+      e.store(RSI, JS_AC, R8);
+      e.storeImm(RSI, JS_PC, addrs[i]);
+      if (i > 0) {
+        e.storeImm(RSI, JS_PCPREV, addrs[i - 1]);
+        e.storeImm(RSI, JS_IR, data[addrs[i - 1]].bits);
+        e.subMem64Imm(RSI, JS_REMAINING, i);
+      }
+      e.movImm(RAX, 1);
+      e.ret();
+    }
+    e.patch32(e.exits[k].first, stubs[i] - (e.exits[k].first + 4));
+  }
+
+  if (jitUsed + e.code.size() > JITBUFSIZE) {
+    jitFlush();
+    jitBlocks[start].tried = true;
+  }
+
+  uint8_t *code = jitBuffer + jitUsed;
+  mprotect(jitBuffer, JITBUFSIZE, PROT_READ | PROT_WRITE);
+  memcpy(code, &e.code[0], e.code.size());
+  mprotect(jitBuffer, JITBUFSIZE, PROT_READ | PROT_EXEC);
+  jitUsed += (e.code.size() + 15) & ~(size_t) 15;
+
+  jitBlocks[start].fn = (JitBlock) code;
+  jitBlocks[start].length = n;
+  jitEntries[start] = code + chainEntry;
+  for (int k = 0; k < n; k++) {
+    jitCovered[addrs[k]]++;
+    jitCodeMap[addrs[k]] = 1;
+  }
+}
+
+#endif
+
+/*
+  Motor JIT: ejecuta los bloques traducidos y usa los manejadores del motor de tabla para las
+  instrucciones que el código nativo no ejecuta. Fuera de Linux x86-64 se usa el motor de goto calculado.
+  Parámetros: el limite de instrucciones por ejecutar (0 para no tener limite).
+  Valor de retorno: el motivo por el que termino la ejecucion.
+*/
+string Machine::runJit(long long maxSteps) {
+#if defined(__x86_64__) && defined(__linux__)
+  if (!jitInit()) {
+    cerr << "No se pudo reservar memoria ejecutable para el JIT; se usa el motor goto." << endl;
+    return runGoto(maxSteps);
+  }
+
+  stepLimit = maxSteps > 0 ? maxSteps : LLONG_MAX;
+  jitFlush();
+
+  JitState st;
+  st.entries = jitEntries;
+  bool interpretNext = false;
+
+  while ((unsigned) PC < MEMSIZE) {
+    if (steps >= stepLimit)
+      return "step_limit";
+
+    if (!interpretNext) {
+      if (!jitBlocks[PC].tried)
+        jitTranslate(PC);
+
+      JitBlockInfo &block = jitBlocks[PC];
+      if (block.fn != NULL && stepLimit - steps >= block.length) {
+        st.ac = AC.bits;
+        st.mar = MAR;
+        st.mdr = MDR.bits;
+        st.ir = IR.bits;
+        st.pc = PC;
+        st.pcPrev = PCprev;
+        st.remaining = stepLimit - steps;
+
+        interpretNext = block.fn((int32_t *) data, &st, jitCodeMap);
+
+        AC.bits = st.ac;
+        MAR = st.mar;
+        MDR.bits = st.mdr;
+        IR.bits = st.ir;
+        PC = st.pc;
+        PCprev = st.pcPrev;
+        steps = stepLimit - st.remaining;
+        continue;
+      }
+    }
+
+    // Instrucción que el código nativo no ejecuta.
+    interpretNext = false;
+    const DecodedInst &inst = decoded[PC];
+    int h = inst.opCode == NOTINST ? H_SKIP : getHandler(inst.opCode, inst.addrType);
+    IR = data[PC];
+    steps++;
+    if (!handlers[h](*this, inst.param))
+      return "halted";
+
+    // Una escritura sobre código traducido descarta los bloques que lo incluyen.
+    if ((h == H_STA_ABS || h == H_STA_IND || h == H_STA_REL) && MAR >= 0 && MAR < MEMSIZE) {
+      if (jitCovered[MAR])
+        jitInvalidate(MAR);
+      jitCodeMap[MAR] = jitCovered[MAR] > 0 || decoded[MAR].opCode != NOTINST;
+    }
+  }
+
+  return "end_of_memory";
+#else
+  return runGoto(maxSteps);
+#endif
+}
+
+/*
+  Traducción anticipada (AOT) de la memoria a un programa de C++.
+  El programa generado tiene una etiqueta por cada celda con instrucción; JMP ABS y JMP REL son saltos directos
+  y JMP IND pasa por un switch sobre el PC. Las celdas sin instrucción (vacías o con datos) no generan código:
+  las recorre un ciclo genérico hasta la siguiente instrucción, así que el programa crece con las instrucciones
+  y no con MEMSIZE (la memoria inicial se escribe como pares dirección, palabra de las celdas no vacías). Las celdas escritas con STA se marcan como modificadas y, si se ejecutan,
+  las ejecuta un intérprete genérico incluido en el programa. Escribe el mismo estado final y los mismos
+  errores que el modo sin menú.
+*/
+const char *aotRuntime = R"AOT(#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+#define WORD_EMPTY INT32_MIN
+#define WORD_INST 0x40000000
+#define MAXDIAGNOSTICS 1000
+
+static int32_t data[MEMSIZE];
+static unsigned char dirty[MEMSIZE];
+static int PC = 0, PCprev = 0, MAR = 0;
+static int32_t MDR = WORD_EMPTY, AC = WORD_EMPTY, IR = WORD_EMPTY;
+static long long steps = 0, limit = LLONG_MAX, diagnosticsCount = 0;
+static char diagnostics[MAXDIAGNOSTICS][48];
+
+static void reportError(const char *msg) {
+  if (diagnosticsCount < MAXDIAGNOSTICS)
+    snprintf(diagnostics[diagnosticsCount], sizeof diagnostics[0], "%lld %s", steps, msg);
+  diagnosticsCount++;
+}
+
+static int value(int32_t w) {
+  if (w >= -MAXVALUE && w <= MAXVALUE)
+    return w;
+  if (w == WORD_EMPTY)
+    return 0;
+  int op = (w >> OPSHIFT) & 0xF, mode = (w >> ADDRSHIFT) & 0xF;
+  if ((w >> SIGNSHIFT) & 0x3)
+    return op * 10 + mode;
+  return (op * 10 + mode) * MEMSIZE + (w & PARAMMASK);
+}
+
+static bool indirect(int p) {
+  MAR = p;
+  MDR = data[MAR];
+  MAR = value(MDR);
+  if (MAR < 0 || MAR >= MEMSIZE) {
+    reportError("OUT OF BOUNDS");
+    return false;
+  }
+  return true;
+}
+
+static void accumulate(int v) {
+  int r = value(AC) + v;
+  if (r > MAXVALUE || r < -MAXVALUE)
+    reportError("OVERFLOW");
+  else
+    AC = r;
+}
+
+static void store(int dir) {
+  MDR = AC;
+  data[dir] = MDR;
+  dirty[dir] = 1;
+}
+
+// Intérprete genérico para las celdas modificadas durante la ejecución. Regresa false con HLT.
+static bool step() {
+  int32_t w = data[PC];
+  IR = w;
+  steps++;
+  if (w < WORD_INST) {
+    PCprev = PC++;
+    return true;
+  }
+
+  int op = (w >> OPSHIFT) & 0xF, mode = (w >> ADDRSHIFT) & 0xF;
+  int p = ((w >> SIGNSHIFT) & 0x3) == 2 ? -(w & PARAMMASK) : (w & PARAMMASK);
+
+  if (op == 7) {
+    if (mode == 1) {
+      PCprev = PC;
+      PC = p;
+    } else if (mode == 2) {
+      if (indirect(p)) {
+        MDR = data[MAR];
+        PCprev = PC;
+        PC = value(MDR);
+      }
+    } else if (mode == 4) {
+      if (PC + p < 0 || PC + p >= MEMSIZE) {
+        reportError("OUT OF BOUNDS");
+      } else {
+        MAR = PC + p;
+        PCprev = PC;
+        PC = MAR;
+      }
+    } else {
+      reportError("INPUT ERROR");
+    }
+    return true;
+  }
+
+  PCprev = PC++;
+  switch (op) {
+    case 0: return true;
+    case 1: AC = 0; return true;
+    case 6: AC = -value(AC); return true;
+    case 8: return false;
+  }
+
+  if (mode == 3 && op != 3) {
+    if (op == 2)
+      AC = p;
+    else
+      accumulate(op == 4 ? p : -p);
+    return true;
+  }
+
+  if (mode == 1) {
+    MAR = p;
+  } else if (mode == 2) {
+    if (!indirect(p))
+      return true;
+  } else if (mode == 4) {
+    if (PC + p < 0 || PC + p >= MEMSIZE) {
+      reportError("OUT OF BOUNDS");
+      return true;
+    }
+    MAR = PC + p;
+  } else {
+    reportError("INSTRUCCION NO VALIDA");
+    return true;
+  }
+
+  if (op == 3) {
+    store(MAR);
+    return true;
+  }
+  MDR = data[MAR];
+  if (op == 2)
+    AC = MDR;
+  else
+    accumulate(op == 4 ? value(MDR) : -value(MDR));
+  return true;
+}
+
+static const char *formatWord(int32_t w, char *buf) {
+  if (w == WORD_EMPTY) {
+    buf[0] = '\0';
+  } else if (w >= -MAXVALUE && w <= MAXVALUE) {
+    snprintf(buf, 16, "%c%0*d", w < 0 ? '-' : '+', WORDDIGITS, w < 0 ? -w : w);
+  } else {
+    int sign = (w >> SIGNSHIFT) & 0x3, mag = w & PARAMMASK;
+    if (sign)
+      snprintf(buf, 16, "%02d%d%c%0*d", (w >> OPSHIFT) & 0xF, (w >> ADDRSHIFT) & 0xF, sign == 1 ? '+' : '-',
+               ADDRDIGITS - 1, mag);
+    else
+      snprintf(buf, 16, "%02d%d%0*d", (w >> OPSHIFT) & 0xF, (w >> ADDRSHIFT) & 0xF, ADDRDIGITS, mag);
+  }
+  return buf;
+}
+
+static const char *completePC(int v, char *buf) {
+  char num[16];
+  int n = snprintf(num, sizeof num, "%d", v), k = 0;
+  for (; k < ADDRDIGITS - n; k++)
+    buf[k] = '0';
+  strcpy(buf + k, num);
+  return buf;
+}
+
+static void dumpState(bool json, const char *status) {
+  char a[16], b[16], c[16], d[16], e[16], f[16];
+  if (json) {
+    printf("{\n  \"status\": \"%s\",\n  \"steps\": %lld,\n", status, steps);
+    printf("  \"registers\": {\"PC\": \"%s\", \"PCprev\": \"%s\", \"MAR\": \"%s\", \"MDR\": \"%s\", \"IR\": \"%s\", \"AC\": \"%s\"},\n",
+           completePC(PC, a), completePC(PCprev, b), completePC(MAR, c), formatWord(MDR, d), formatWord(IR, e), formatWord(AC, f));
+    printf("  \"diagnosticsCount\": %lld,\n  \"diagnostics\": [", diagnosticsCount);
+    for (long long i = 0; i < diagnosticsCount && i < MAXDIAGNOSTICS; i++)
+      printf("%s\"%s\"", i ? ", " : "", diagnostics[i]);
+    printf("],\n  \"memory\": [");
+    bool first = true;
+    for (int i = 0; i < MEMSIZE; i++) {
+      if (data[i] != WORD_EMPTY) {
+        printf("%s    {\"address\": \"%s\", \"word\": \"%s\"}", first ? "\n" : ",\n", completePC(i, a), formatWord(data[i], d));
+        first = false;
+      }
+    }
+    printf("%s]\n}\n", first ? "" : "\n  ");
+  } else {
+    printf("status %s\nsteps %lld\n", status, steps);
+    printf("PC %s\nPCprev %s\nMAR %s\n", completePC(PC, a), completePC(PCprev, b), completePC(MAR, c));
+    printf("MDR %s\nIR %s\nAC %s\n", formatWord(MDR, d), formatWord(IR, e), formatWord(AC, f));
+    printf("diagnostics %lld\n", diagnosticsCount);
+    for (long long i = 0; i < diagnosticsCount && i < MAXDIAGNOSTICS; i++)
+      printf("error %s\n", diagnostics[i]);
+    for (int i = 0; i < MEMSIZE; i++)
+      if (data[i] != WORD_EMPTY)
+        printf("%s %s\n", completePC(i, a), formatWord(data[i], d));
+  }
+}
+)AOT";
+
+/*
+  Funcion que escribe la traducción anticipada de la memoria como un programa de C++.
+  Parámetros: el flujo de salida y el nombre del programa original (para el comentario inicial).
+  Valor de retorno: ninguno.
+*/
+void Machine::writeAot(ostream &out, string sourceName) {
+  out << "// Traducción anticipada de " << sourceName << " generada por Simulator." << endl;
+  out << "// Compilar con: g++ -O2 programa.cpp -o programa" << endl;
+  out << "// Uso: programa [-n pasos] [-f text|json]" << endl << endl;
+  // Tamaño de la máquina con la que se compiló el simulador (ver WordFormat).
+  out << "#define ADDRDIGITS " << ADDRDIGITS << endl;
+  out << "#define WORDDIGITS " << WORDDIGITS << endl;
+  out << "#define MEMSIZE " << MEMSIZE << endl;
+  out << "#define MAXVALUE " << MAXVALUE << endl;
+  out << "#define PARAMMASK " << Format::paramMask << endl;
+  out << "#define SIGNSHIFT " << Format::signShift << endl;
+  out << "#define ADDRSHIFT " << Format::addrShift << endl;
+  out << "#define OPSHIFT " << Format::opShift << endl << endl;
+  out << aotRuntime << endl;
+
+  // Celdas no vacías como {dirección, palabra}; {-1, 0} termina la lista.
+  out << "static const int32_t image[][2] = {";
+  int cells = 0;
+  for (int i = 0; i < MEMSIZE; i++)
+    if (!data[i].isEmpty())
+      out << (cells++ % 5 ? " " : "\n  ") << "{" << i << ", " << data[i].bits << "},";
+  out << (cells % 5 ? " " : "\n  ") << "{-1, 0}\n};" << endl << endl;
+
+  out << "int main(int argc, char **argv) {" << endl;
+  out << "  bool json = false;" << endl;
+  out << "  for (int i = 1; i < argc; i++) {" << endl;
+  out << "    if (!strcmp(argv[i], \"-n\") && i + 1 < argc) {" << endl;
+  out << "      long long n = atoll(argv[++i]);" << endl;
+  out << "      limit = n > 0 ? n : LLONG_MAX;" << endl;
+  out << "    } else if (!strcmp(argv[i], \"-f\") && i + 1 < argc) {" << endl;
+  out << "      json = !strcmp(argv[++i], \"json\");" << endl;
+  out << "    }" << endl;
+  out << "  }" << endl;
+  out << "  for (int i = 0; i < MEMSIZE; i++)" << endl;
+  out << "    data[i] = WORD_EMPTY;" << endl;
+  out << "  for (int i = 0; image[i][0] >= 0; i++)" << endl;
+  out << "    data[image[i][0]] = image[i][1];" << endl;
+  out << "  goto dispatch;" << endl << endl;
+
+  // Despachador para JMP IND, para volver del intérprete genérico y para llegar a una instrucción desde
+  // las celdas sin instrucción.
+  out << "dispatch:" << endl;
+  out << "  switch (PC) {" << endl;
+  for (int i = 0; i < MEMSIZE; i++)
+    if (decoded[i].opCode != NOTINST)
+      out << "    case " << i << ": goto L_" << i << ";" << endl;
+  out << "    default: if ((unsigned) PC < MEMSIZE) goto skip; goto end_of_memory;" << endl;
+  out << "  }" << endl << endl;
+
+  // Celdas sin instrucción: avanzan el PC una por una hasta la siguiente instrucción.
+  out << "skip:" << endl;
+  out << "  while ((unsigned) PC < MEMSIZE) {" << endl;
+  out << "    if (steps >= limit) goto step_limit;" << endl;
+  out << "    if (dirty[PC]) goto interpret;" << endl;
+  out << "    if (data[PC] >= WORD_INST) goto dispatch;" << endl;
+  out << "    IR = data[PC]; steps++; PCprev = PC++;" << endl;
+  out << "  }" << endl;
+  out << "  goto end_of_memory;" << endl << endl;
+
+  out << "interpret:" << endl;
+  out << "  while ((unsigned) PC < MEMSIZE && dirty[PC] && steps < limit)" << endl;
+  out << "    if (!step())" << endl;
+  out << "      goto halted;" << endl;
+  out << "  goto dispatch;" << endl << endl;
+
+  // Salto a la dirección t: directo si tiene instrucción, por el ciclo de celdas sin instrucción si no.
+  auto jumpTo = [&](int t) {
+    if (decoded[t].opCode != NOTINST)
+      return "goto L_" + to_string(t) + ";";
+    return "PC = " + to_string(t) + "; goto skip;";
+  };
+
+  for (int a = 0; a < MEMSIZE; a++) {
+    const DecodedInst &d = decoded[a];
+    if (d.opCode == NOTINST)
+      continue;
+    int h = getHandler(d.opCode, d.addrType);
+    int p = d.param;
+    int t = h == H_JMP_REL ? a + p : a + 1 + p;
+    bool outside = t < 0 || t >= MEMSIZE;
+
+    out << "L_" << a << ":" << endl;
+    out << "  if (steps >= limit) { PC = " << a << "; goto step_limit; }" << endl;
+    out << "  if (dirty[" << a << "]) { PC = " << a << "; goto interpret; }" << endl;
+    out << "  IR = " << data[a].bits << "; steps++;" << endl;
+
+    switch (h) {
+      case H_CLA: out << "  AC = 0;" << endl; break;
+      case H_NEG: out << "  AC = -value(AC);" << endl; break;
+      case H_LDA_ABS: out << "  MAR = " << p << "; MDR = data[MAR]; AC = MDR;" << endl; break;
+      case H_LDA_IND: out << "  if (indirect(" << p << ")) { MDR = data[MAR]; AC = MDR; }" << endl; break;
+      case H_LDA_INM: out << "  AC = " << p << ";" << endl; break;
+      case H_STA_ABS: out << "  MAR = " << p << "; store(MAR);" << endl; break;
+      case H_STA_IND: out << "  if (indirect(" << p << ")) store(MAR);" << endl; break;
+      case H_ADD_ABS: out << "  MAR = " << p << "; MDR = data[MAR]; accumulate(value(MDR));" << endl; break;
+      case H_ADD_IND: out << "  if (indirect(" << p << ")) { MDR = data[MAR]; accumulate(value(MDR)); }" << endl; break;
+      case H_ADD_INM: out << "  accumulate(" << p << ");" << endl; break;
+      case H_SUB_ABS: out << "  MAR = " << p << "; MDR = data[MAR]; accumulate(-value(MDR));" << endl; break;
+      case H_SUB_IND: out << "  if (indirect(" << p << ")) { MDR = data[MAR]; accumulate(-value(MDR)); }" << endl; break;
+      case H_SUB_INM: out << "  accumulate(" << -p << ");" << endl; break;
+      case H_LDA_REL:
+      case H_STA_REL:
+      case H_ADD_REL:
+      case H_SUB_REL:
+        if (outside)
+          out << "  reportError(\"OUT OF BOUNDS\");" << endl;
+        else if (h == H_LDA_REL)
+          out << "  MAR = " << t << "; MDR = data[MAR]; AC = MDR;" << endl;
+        else if (h == H_STA_REL)
+          out << "  MAR = " << t << "; store(MAR);" << endl;
+        else
+          out << "  MAR = " << t << "; MDR = data[MAR]; accumulate(" << (h == H_ADD_REL ? "" : "-") << "value(MDR));" << endl;
+        break;
+      case H_INVALID: out << "  reportError(\"INSTRUCCION NO VALIDA\");" << endl; break;
+      case H_JMP_ABS:
+        out << "  PCprev = " << a << "; " << jumpTo(p) << endl;
+        continue;
+      case H_JMP_REL:
+        if (outside)
+          out << "  reportError(\"OUT OF BOUNDS\"); goto L_" << a << ";" << endl;
+        else
+          out << "  MAR = " << t << "; PCprev = " << a << "; " << jumpTo(t) << endl;
+        continue;
+      case H_JMP_IND:
+        out << "  if (indirect(" << p << ")) { MDR = data[MAR]; PCprev = " << a << "; PC = value(MDR); goto dispatch; }" << endl;
+        out << "  goto L_" << a << ";" << endl;
+        continue;
+      case H_JMP_INVALID:
+        out << "  reportError(\"INPUT ERROR\"); goto L_" << a << ";" << endl;
+        continue;
+      case H_HLT:
+        out << "  PCprev = " << a << "; PC = " << a + 1 << "; goto halted;" << endl;
+        continue;
+    }
+    out << "  PCprev = " << a << ";" << endl;
+    if (a + 1 == MEMSIZE)
+      out << "  PC = " << MEMSIZE << "; goto end_of_memory;" << endl;
+    else if (decoded[a + 1].opCode == NOTINST)
+      out << "  PC = " << a + 1 << "; goto skip;" << endl;
+  }
+  out << endl;
+  out << "end_of_memory:" << endl;
+  out << "  dumpState(json, \"end_of_memory\");" << endl;
+  out << "  return 0;" << endl;
+  out << "step_limit:" << endl;
+  out << "  dumpState(json, \"step_limit\");" << endl;
+  out << "  return 0;" << endl;
+  out << "halted:" << endl;
+  out << "  dumpState(json, \"halted\");" << endl;
+  out << "  return 0;" << endl;
+  out << "}" << endl;
+}
+
+/*
+  Funcion que ejecuta el programa sin mostrar las microoperaciones hasta encontrar HLT, salir de la
+  memoria o llegar al limite de pasos.
+  Parámetros: el limite de instrucciones por ejecutar (0 para no tener limite) y el motor por usar.
+  Valor de retorno: string con el motivo por el que termino la ejecucion ("halted", "end_of_memory" o "step_limit").
+*/
+string Machine::runHeadless(long long maxSteps, Engine engine) {
+  PC = 0;
+  PCprev = 0;
+  steps = 0;
+  microops = 0;
+  return resume(maxSteps, engine);
+}
+
+/*
+  Funcion que continúa la ejecución sin menú desde el estado actual de los registros
+  (por ejemplo, una máquina que el motor SIMD separó de su grupo).
+  Parámetros: el limite de instrucciones por ejecutar contando las ya ejecutadas (0 para no tener limite)
+              y el motor por usar.
+  Valor de retorno: string con el motivo por el que termino la ejecucion.
+*/
+string Machine::resume(long long maxSteps, Engine engine) {
+  if (engine == ENGINE_TABLE)
+    return runTable(maxSteps);
+  if (engine == ENGINE_GOTO)
+    return runGoto(maxSteps);
+  if (engine == ENGINE_JIT) {
+    // El código traducido escribe en la memoria sin writeMemory().
+    string status = runJit(maxSteps);
+    rebuildIndex();
+    return status;
+  }
+  if (profile)
+    return runClassic<true>(maxSteps);
+  return runClassic<false>(maxSteps);
+}
+
+/*
+  Funcion que ejecuta con el motor clásico sin mostrar las microoperaciones, con o sin perfil.
+  Parámetros: el limite de instrucciones por ejecutar contando las ya ejecutadas (0 para no tener limite).
+  Valor de retorno: string con el motivo por el que termino la ejecucion.
+*/
+template <bool Profiling>
+string Machine::runClassic(long long maxSteps) {
+  while (PC >= 0 && PC < MEMSIZE) {
+    if (maxSteps > 0 && steps >= maxSteps)
+      return "step_limit";
+    if (!executeStep<Profiling>())
+      return "halted";
+  }
+
+  return "end_of_memory";
+}
+
+/*
+  Puntos de control de las ejecuciones sin menú: un archivo con todo lo que hace falta para continuar
+  exactamente igual (registros, pasos, microoperaciones, errores y memoria).
+
+  Formato (binario, en el orden de bytes de la máquina que lo escribe):
+    "SIMCKPT1", steps, microops y diagnosticsCount (int64), PC, PCprev, MAR, MDR, IR y AC (int32),
+    las MEMSIZE palabras (int32), el número de errores guardados (uint32) y cada uno como longitud (uint32)
+    y texto, y al final el hash FNV-1a de 64 bits de todo lo anterior.
+  El hash sólo detecta archivos dañados; al leerlo además se validan las palabras (isValidWord) y PC.
+
+  Se escribe en ARCHIVO.tmp y se renombra sobre ARCHIVO, así que si el proceso muere a la mitad
+  el último punto de control completo sigue en su lugar.
+*/
+
+#define CHECKPOINTMAGIC "SIMCKPT1"
+// Instrucciones entre puntos de control si no se indica --checkpoint-every.
+#define CHECKPOINTEVERY 100000000LL
+
+// Función que calcula el hash FNV-1a de 64 bits de un bloque de bytes.
+// Parámetros: los bytes y su longitud.
+// Valor de retorno: el hash.
+uint64_t fnv1a(const char *bytes, size_t length) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= (unsigned char) bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Funciones que agregan un valor al final de un punto de control y lo leen de su posición.
+template <typename T>
+void putRaw(string &out, T value) {
+  out.append((const char *) &value, sizeof value);
+}
+
+template <typename T>
+bool getRaw(const string &in, size_t &pos, T &value) {
+  if (in.size() - pos < sizeof value)
+    return false;
+  memcpy(&value, in.data() + pos, sizeof value);
+  pos += sizeof value;
+  return true;
+}
+
+/*
+  Funcion que escribe un punto de control del estado actual de la máquina.
+  Parámetros: el nombre del archivo.
+  Valor de retorno: false si no se pudo escribir (el punto de control anterior no cambia).
+*/
+bool Machine::writeCheckpoint(string fileName) const {
+  string out = CHECKPOINTMAGIC;
+  putRaw<int64_t>(out, steps);
+  putRaw<int64_t>(out, microops);
+  putRaw<int64_t>(out, diagnosticsCount);
+  putRaw<int32_t>(out, PC);
+  putRaw<int32_t>(out, PCprev);
+  putRaw<int32_t>(out, MAR);
+  putRaw<int32_t>(out, MDR.bits);
+  putRaw<int32_t>(out, IR.bits);
+  putRaw<int32_t>(out, AC.bits);
+  for (int i = 0; i < MEMSIZE; i++)
+    putRaw<int32_t>(out, data[i].bits);
+  putRaw<uint32_t>(out, diagnostics.size());
+  for (size_t i = 0; i < diagnostics.size(); i++) {
+    putRaw<uint32_t>(out, diagnostics[i].size());
+    out += diagnostics[i];
+  }
+  putRaw<uint64_t>(out, fnv1a(out.data(), out.size()));
+
+  string tmpName = fileName + ".tmp";
+  FILE *file = fopen(tmpName.c_str(), "wb");
+  if (file == NULL)
+    return false;
+  bool written = fwrite(out.data(), 1, out.size(), file) == out.size() && fflush(file) == 0;
+#ifndef _WIN32
+  // Que el contenido llegue al disco antes de que el nombre apunte a él.
+  written = written && fsync(fileno(file)) == 0;
+#endif
+  written = fclose(file) == 0 && written;
+
+  error_code error;
+  if (written)
+    filesystem::rename(tmpName, fileName, error);
+  if (!written || error) {
+    filesystem::remove(tmpName, error);
+    return false;
+  }
+  return true;
+}
+
+/*
+  Funcion que restaura la máquina desde un punto de control.
+  Parámetros: el nombre del archivo.
+  Valor de retorno: false si no se pudo leer o no es un punto de control válido (la máquina no cambia).
+*/
+bool Machine::readCheckpoint(string fileName) {
+  ifstream file(fileName.c_str(), ios::binary);
+  if (!file.is_open())
+    return false;
+  string in((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+  size_t magicLength = strlen(CHECKPOINTMAGIC);
+  uint64_t hash;
+  if (in.size() < magicLength + sizeof hash || in.compare(0, magicLength, CHECKPOINTMAGIC) != 0)
+    return false;
+  memcpy(&hash, in.data() + in.size() - sizeof hash, sizeof hash);
+  in.resize(in.size() - sizeof hash);
+  if (hash != fnv1a(in.data(), in.size()))
+    return false;
+
+  size_t pos = magicLength;
+  int64_t savedSteps, savedMicroops, savedCount;
+  int32_t regs[6];
+  vector<Word> memory(MEMSIZE);
+  uint32_t savedErrors;
+  bool ok = getRaw(in, pos, savedSteps) && getRaw(in, pos, savedMicroops) && getRaw(in, pos, savedCount);
+  for (int i = 0; ok && i < 6; i++)
+    ok = getRaw(in, pos, regs[i]);
+  for (int i = 0; ok && i < MEMSIZE; i++)
+    ok = getRaw(in, pos, memory[i].bits) && isValidWord(memory[i]);
+  // Las palabras se validan igual que en loadImage. PC puede valer MEMSIZE (el motor lo detecta como
+  // end_of_memory), MAR no se restringe porque un error de direccionamiento lo deja fuera de la memoria.
+  ok = ok && regs[0] >= 0 && regs[0] <= MEMSIZE && regs[1] >= 0 && regs[1] < MEMSIZE;
+  for (int i = 3; ok && i < 6; i++)
+    ok = isValidWord(Word{regs[i]});
+  ok = ok && getRaw(in, pos, savedErrors) && savedErrors <= MAXDIAGNOSTICS;
+
+  vector<string> errors;
+  for (uint32_t i = 0; ok && i < savedErrors; i++) {
+    uint32_t length;
+    ok = getRaw(in, pos, length) && in.size() - pos >= length;
+    if (ok) {
+      errors.push_back(in.substr(pos, length));
+      pos += length;
+    }
+  }
+  if (!ok || pos != in.size())
+    return false;
+
+  steps = savedSteps;
+  microops = savedMicroops;
+  diagnosticsCount = savedCount;
+  diagnostics = errors;
+  PC = regs[0];
+  PCprev = regs[1];
+  MAR = regs[2];
+  MDR.bits = regs[3];
+  IR.bits = regs[4];
+  AC.bits = regs[5];
+  memcpy(data, memory.data(), sizeof data);
+  decodeMemory();
+  return true;
+}
+
+/*
+  Funcion que ejecuta sin menú escribiendo un punto de control cada cierto número de instrucciones.
+  Los motores se detienen exactamente en el límite de pasos, así que ejecutar por tramos da el mismo
+  resultado que ejecutar de una vez.
+  Parámetros: el limite de instrucciones (0 para no tener limite), el motor, el archivo del punto de control,
+              las instrucciones entre puntos de control y si se continúa desde el estado actual (restaurado
+              con readCheckpoint) en vez de empezar desde la dirección 0.
+  Valor de retorno: string con el motivo por el que termino la ejecucion.
+*/
+string Machine::runCheckpointed(long long maxSteps, Engine engine, string fileName, long long every,
+                                bool fromCheckpoint) {
+  if (!fromCheckpoint) {
+    PC = 0;
+    PCprev = 0;
+    steps = 0;
+    microops = 0;
+  }
+
+  while (true) {
+    long long next = (steps / every + 1) * every;
+    string status = resume(maxSteps > 0 ? min(maxSteps, next) : next, engine);
+    if (status != "step_limit" || (maxSteps > 0 && steps >= maxSteps))
+      return status;
+    if (!writeCheckpoint(fileName))
+      cerr << "No se pudo escribir el punto de control " << fileName << " (instrucción " << steps << ")" << endl;
+  }
+}
+
+/*
+  Trazo binario de la ejecución (--trace) y su reproductor (--replay).
+
+  El trazo empieza con "SIMTRACE", los pasos ya ejecutados (int64), PC, PCprev, MAR, MDR, IR y AC (int32)
+  y las MEMSIZE palabras (int32). Después va un registro por instrucción con lo que cambió respecto al anterior:
+  un byte de banderas y, por cada bandera encendida, su valor como varint (LEB128; los que tienen signo en
+  zigzag):
+    TR_JUMP     PC distinto de PC + 1: PC nuevo - (PC anterior + 1)
+    TR_MAR      MAR nuevo - MAR anterior
+    TR_MDR      MDR nuevo - MDR anterior (sus bits)
+    TR_AC       AC nuevo - AC anterior (sus bits)
+    TR_WRITE    se escribió MDR en la celda MAR (todas las escrituras de los manejadores son así); sin valor
+    TR_ERRORS   número de errores y cada uno como longitud y texto
+    TR_PCPREV   PCprev distinto del PC anterior: PCprev - PC anterior
+  Un registro con TR_END termina el trazo con el motivo (longitud y texto).
+  IR no se guarda: es la palabra de la memoria en el PC anterior, y el reproductor lleva la memoria.
+  Una instrucción común ocupa entre 1 y 4 bytes.
+
+  Se graba con el motor de tabla sin superinstrucciones (cada instrucción es un paso). El reproductor aplica
+  los registros en orden sobre una máquina, así que reconstruye el estado después de cualquier paso igual que
+  si se hubiera ejecutado hasta ahí, y puede mostrarlo con la animación (un cuadro por instrucción).
+*/
+
+#define TRACEMAGIC "SIMTRACE"
+
+enum TraceFlag {
+  TR_JUMP = 1, TR_MAR = 2, TR_MDR = 4, TR_AC = 8, TR_WRITE = 16, TR_ERRORS = 32, TR_PCPREV = 64, TR_END = 128
+};
+
+// Función que abre el archivo del trazo y escribe el encabezado con el estado inicial de la máquina.
+// Parámetros: el nombre del archivo y la máquina.
+// Valor de retorno: false si no se pudo abrir.
+bool TraceWriter::open(string fileName, const Machine &machine) {
+  file = fopen(fileName.c_str(), "wb");
+  if (file == NULL)
+    return false;
+  buffer.reset(new uint8_t[TRACEBUFSIZE]);
+  used = 0;
+  failed = false;
+
+  string header = TRACEMAGIC;
+  putRaw<int64_t>(header, machine.steps);
+  putRaw<int32_t>(header, machine.PC);
+  putRaw<int32_t>(header, machine.PCprev);
+  putRaw<int32_t>(header, machine.MAR);
+  putRaw<int32_t>(header, machine.MDR.bits);
+  putRaw<int32_t>(header, machine.IR.bits);
+  putRaw<int32_t>(header, machine.AC.bits);
+  for (int i = 0; i < MEMSIZE; i++)
+    putRaw<int32_t>(header, machine.data[i].bits);
+  // Con memorias grandes el encabezado no cabe en el buffer; se escribe directo.
+  if (fwrite(header.data(), 1, header.size(), file) != header.size())
+    failed = true;
+
+  PCprev = machine.PCprev;
+  MAR = machine.MAR;
+  MDR = machine.MDR;
+  AC = machine.AC;
+  written = false;
+  errors.clear();
+  return true;
+}
+
+void TraceWriter::putVarint(uint64_t value) {
+  while (value >= 0x80) {
+    putByte((uint8_t) (value | 0x80));
+    value >>= 7;
+  }
+  putByte((uint8_t) value);
+}
+
+void TraceWriter::putText(const string &text) {
+  putVarint(text.size());
+  for (size_t i = 0; i < text.size(); i++) {
+    if (TRACEBUFSIZE - used < 16)
+      flush();
+    putByte(text[i]);
+  }
+}
+
+void TraceWriter::flush() {
+  if (used > 0 && !failed && fwrite(buffer.get(), 1, used, file) != used)
+    failed = true;
+  used = 0;
+}
+
+/*
+  Funcion que graba el registro de la instrucción que se acaba de ejecutar.
+  Parámetros: la máquina y el PC antes de la instrucción.
+  Valor de retorno: ninguno.
+*/
+inline void TraceWriter::step(const Machine &machine, int pcBefore) {
+  // Un registro sin errores ocupa a lo más 1 + 5 varints de 10 bytes.
+  if (TRACEBUFSIZE - used < 64)
+    flush();
+
+  uint8_t flags = 0;
+  if (machine.PC != pcBefore + 1)
+    flags |= TR_JUMP;
+  if (machine.MAR != MAR)
+    flags |= TR_MAR;
+  if (machine.MDR != MDR)
+    flags |= TR_MDR;
+  if (machine.AC != AC)
+    flags |= TR_AC;
+  if (written)
+    flags |= TR_WRITE;
+  if (!errors.empty())
+    flags |= TR_ERRORS;
+  if (machine.PCprev != pcBefore)
+    flags |= TR_PCPREV;
+
+  putByte(flags);
+  if (flags & TR_JUMP)
+    putSigned(machine.PC - (pcBefore + 1));
+  if (flags & TR_MAR)
+    putSigned(machine.MAR - MAR);
+  if (flags & TR_MDR)
+    putSigned((int64_t) machine.MDR.bits - MDR.bits);
+  if (flags & TR_AC)
+    putSigned((int64_t) machine.AC.bits - AC.bits);
+  if (flags & TR_ERRORS) {
+    putVarint(errors.size());
+    for (size_t i = 0; i < errors.size(); i++)
+      putText(errors[i]);
+    errors.clear();
+  }
+  if (flags & TR_PCPREV)
+    putSigned(machine.PCprev - pcBefore);
+
+  PCprev = machine.PCprev;
+  MAR = machine.MAR;
+  MDR = machine.MDR;
+  AC = machine.AC;
+  written = false;
+}
+
+// Función que termina el trazo con el motivo (si se da) y cierra el archivo.
+// Parámetro: el motivo por el que terminó la ejecución.
+// Valor de retorno: false si algo no se pudo escribir.
+bool TraceWriter::close(string status) {
+  if (file == NULL)
+    return !failed;
+  if (status != "") {
+    if (TRACEBUFSIZE - used < 16)
+      flush();
+    putByte(TR_END);
+    putText(status);
+  }
+  flush();
+  if (fclose(file) != 0)
+    failed = true;
+  file = NULL;
+  return !failed;
+}
+
+/*
+  Funcion que ejecuta sin menú grabando el trazo (motor de tabla sin superinstrucciones).
+  Parámetros: el limite de instrucciones contando las ya ejecutadas (0 para no tener limite) y el grabador,
+              ya abierto con el estado inicial.
+  Valor de retorno: string con el motivo por el que termino la ejecucion.
+*/
+string Machine::runTraced(long long maxSteps, TraceWriter &writer) {
+  bool fusion = fusionEnabled;
+  if (fusion) {
+    fusionEnabled = false;
+    decodeMemory();
+  }
+  trace = &writer;
+  stepLimit = maxSteps > 0 ? maxSteps : LLONG_MAX;
+
+  string status = "end_of_memory";
+  while ((unsigned) PC < MEMSIZE) {
+    if (steps >= stepLimit) {
+      status = "step_limit";
+      break;
+    }
+    const DecodedInst &inst = decoded[PC];
+    int pcBefore = PC;
+    IR = data[PC];
+    steps++;
+    bool running = handlers[inst.handler](*this, inst.param);
+    writer.step(*this, pcBefore);
+    if (!running) {
+      status = "halted";
+      break;
+    }
+  }
+
+  trace = NULL;
+  if (fusion) {
+    fusionEnabled = true;
+    decodeMemory();
+  }
+  return status;
+}
+
+/*
+  Lector del trazo para el reproductor. Lee el archivo por bloques de TRACEBUFSIZE.
+*/
+class TraceReader {
+public:
+  TraceReader() : failed(false), used(0), size(0) {}
+  bool open(string fileName, Machine &machine);
+  bool next(Machine &machine);
+  bool atEnd();
+  // Motivo con el que terminó la ejecución grabada ("" si el trazo se cortó antes de su final).
+  string status;
+  // Algo no se pudo leer o el trazo no es válido.
+  bool failed;
+
+private:
+  bool getByte(uint8_t &byte);
+  bool getVarint(uint64_t &value);
+  bool getSigned(int64_t &value);
+  bool getText(string &text);
+
+  ifstream file;
+  unique_ptr<char[]> buffer;
+  size_t used, size;
+};
+
+bool TraceReader::getByte(uint8_t &byte) {
+  if (used == size) {
+    file.read(buffer.get(), TRACEBUFSIZE);
+    size = file.gcount();
+    used = 0;
+    if (size == 0)
+      return false;
+  }
+  byte = buffer[used++];
+  return true;
+}
+
+bool TraceReader::getVarint(uint64_t &value) {
+  value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    uint8_t byte;
+    if (!getByte(byte))
+      return false;
+    value |= (uint64_t) (byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+bool TraceReader::getSigned(int64_t &value) {
+  uint64_t raw;
+  if (!getVarint(raw))
+    return false;
+  value = (int64_t) (raw >> 1) ^ -(int64_t) (raw & 1);
+  return true;
+}
+
+bool TraceReader::getText(string &text) {
+  uint64_t length;
+  if (!getVarint(length) || length > TRACEBUFSIZE)
+    return false;
+  text.resize(length);
+  for (size_t i = 0; i < length; i++) {
+    uint8_t byte;
+    if (!getByte(byte))
+      return false;
+    text[i] = byte;
+  }
+  return true;
+}
+
+// Función que abre un trazo y pone en la máquina su estado inicial.
+// Parámetros: el nombre del archivo y la máquina.
+// Valor de retorno: false si no se pudo abrir o no es un trazo.
+bool TraceReader::open(string fileName, Machine &machine) {
+  file.open(fileName.c_str(), ios::binary);
+  if (!file.is_open())
+    return false;
+  buffer.reset(new char[TRACEBUFSIZE]);
+
+  size_t magicLength = strlen(TRACEMAGIC);
+  string header(magicLength + sizeof(int64_t) + (6 + MEMSIZE) * sizeof(int32_t), '\0');
+  if (!file.read(&header[0], header.size()) || header.compare(0, magicLength, TRACEMAGIC) != 0)
+    return false;
+
+  size_t pos = magicLength;
+  int64_t steps = 0;
+  int32_t regs[6];
+  getRaw(header, pos, steps);
+  for (int i = 0; i < 6; i++)
+    getRaw(header, pos, regs[i]);
+  for (int i = 0; i < MEMSIZE; i++)
+    getRaw(header, pos, machine.data[i].bits);
+  machine.decodeMemory();
+  machine.steps = steps;
+  machine.PC = regs[0];
+  machine.PCprev = regs[1];
+  machine.MAR = regs[2];
+  machine.MDR.bits = regs[3];
+  machine.IR.bits = regs[4];
+  machine.AC.bits = regs[5];
+  return true;
+}
+
+/*
+  Funcion que aplica el siguiente registro del trazo a la máquina (una instrucción). La escritura se marca
+  en lastWrite y los errores se reportan con reportError(), como si la máquina la hubiera ejecutado.
+  Parámetros: la máquina.
+  Valor de retorno: false al final del trazo (status dice por qué terminó) o si no es válido (failed).
+*/
+bool TraceReader::next(Machine &machine) {
+  uint8_t flags;
+  if (!getByte(flags))
+    return false;
+  if (flags & TR_END) {
+    failed = !getText(status);
+    return false;
+  }
+  if ((unsigned) machine.PC >= MEMSIZE) {
+    failed = true;
+    return false;
+  }
+
+  int pcBefore = machine.PC;
+  int64_t delta = 0;
+  machine.IR = machine.data[pcBefore];
+  machine.steps++;
+  bool ok = true;
+  if (flags & TR_JUMP)
+    ok = getSigned(delta);
+  machine.PC = pcBefore + 1 + delta;
+  if (ok && (flags & TR_MAR) && (ok = getSigned(delta)))
+    machine.MAR += delta;
+  if (ok && (flags & TR_MDR) && (ok = getSigned(delta)))
+    machine.MDR.bits += delta;
+  if (ok && (flags & TR_AC) && (ok = getSigned(delta)))
+    machine.AC.bits += delta;
+  if (ok && (flags & TR_ERRORS)) {
+    uint64_t count;
+    ok = getVarint(count);
+    for (uint64_t i = 0; ok && i < count; i++) {
+      string msg;
+      if ((ok = getText(msg)))
+        machine.reportError(msg);
+    }
+  }
+  machine.PCprev = pcBefore;
+  if (ok && (flags & TR_PCPREV) && (ok = getSigned(delta)))
+    machine.PCprev += delta;
+
+  if (ok && (flags & TR_WRITE)) {
+    if ((unsigned) machine.MAR >= MEMSIZE)
+      ok = false;
+    else {
+      machine.writeMemory(machine.MAR, machine.MDR);
+      machine.lastWrite = machine.MAR;
+    }
+  }
+  failed = !ok;
+  return ok;
+}
+
+// Función que revisa si ya no quedan instrucciones en el trazo (y lee el motivo del final si sigue).
+// Parámetros: ninguno.
+// Valor de retorno: true si el trazo termina aquí.
+bool TraceReader::atEnd() {
+  uint8_t flags;
+  if (!getByte(flags))
+    return true;
+  if (!(flags & TR_END)) {
+    used--;
+    return false;
+  }
+  failed = !getText(status);
+  return true;
+}
+
+/*
+  Funcion del reproductor (--replay): reconstruye la máquina después del paso dado y escribe su estado;
+  con animación muestra además las instrucciones siguientes con la vista de la animación.
+  Parámetros: el trazo, el paso (-1 para el final), cuántas instrucciones se animan desde ahí (0 para ninguna)
+              y el formato de salida.
+  Valor de retorno: código de salida (0 éxito, 1 si el trazo no se pudo leer).
+*/
+int replayTrace(string fileName, long long at, long long animateSteps, string format) {
+  TraceReader reader;
+  Machine &machine = sim;
+  machine.headlessMode = true;
+  if (!reader.open(fileName, machine)) {
+    cerr << "No se pudo leer el trazo " << fileName << endl;
+    return 1;
+  }
+
+  bool more = true;
+  while ((at < 0 || machine.steps < at) && (more = reader.next(machine)))
+    ;
+  machine.lastWrite = -1;
+
+  if (animateSteps > 0 && more) {
+    machine.headlessMode = false;
+    animation.start(machine);
+    pacer.reset();
+    for (long long i = 0; i < animateSteps && (more = reader.next(machine)); i++) {
+      if (!maxSpeed)
+        pacer.wait(secs);
+      animation.publish(machine);
+    }
+    animation.finish(machine);
+    machine.headlessMode = true;
+    cout << endl;
+  }
+
+  more = more && !reader.atEnd();
+  if (reader.failed) {
+    cerr << "El trazo " << fileName << " no es válido (después de la instrucción " << machine.steps << ")" << endl;
+    return 1;
+  }
+  string status = more ? "step_limit" : reader.status != "" ? reader.status : "trace_end";
+  machine.dumpState(cout, format, status);
+  return 0;
+}
+
+/*
+  Funcion que escribe en texto o JSON el estado final de los registros y de las direcciones de memoria no vacias.
+  Parámetros: el flujo de salida, el formato ("text" o "json"), el motivo por el que termino la ejecucion
+              y el nombre del programa (sólo se escribe si no está vacío, como en el modo por lotes).
+  Valor de retorno: ninguno.
+*/
+void Machine::dumpState(ostream &out, string format, string status, string program) {
+  if (format == "json") {
+    out << "{\n";
+    if (program != "")
+      out << "  \"program\": \"" << jsonEscape(program) << "\",\n";
+    out << "  \"status\": \"" << status << "\",\n";
+    out << "  \"steps\": " << steps << ",\n";
+    out << "  \"registers\": {\"PC\": \"" << completePC(PC) << "\", \"PCprev\": \"" << completePC(PCprev)
+        << "\", \"MAR\": \"" << completePC(MAR) << "\", \"MDR\": \"" << MDR << "\", \"IR\": \"" << IR
+        << "\", \"AC\": \"" << AC << "\"},\n";
+    out << "  \"diagnosticsCount\": " << diagnosticsCount << ",\n";
+    out << "  \"diagnostics\": [";
+    for (size_t i = 0; i < diagnostics.size(); i++)
+      out << (i ? ", " : "") << "\"" << diagnostics[i] << "\"";
+    out << "],\n";
+    out << "  \"memory\": [";
+    bool first = true;
+    for (int i = nextOccupied(0); i < MEMSIZE; i = nextOccupied(i + 1)) {
+      out << (first ? "\n" : ",\n") << "    {\"address\": \"" << completePC(i) << "\", \"word\": \"" << data[i] << "\"}";
+      first = false;
+    }
+    out << (first ? "" : "\n  ") << "]\n";
+    out << "}" << endl;
+  } else {
+    if (program != "")
+      out << "program " << program << endl;
+    out << "status " << status << endl;
+    out << "steps " << steps << endl;
+    out << "PC " << completePC(PC) << endl;
+    out << "PCprev " << completePC(PCprev) << endl;
+    out << "MAR " << completePC(MAR) << endl;
+    out << "MDR " << MDR << endl;
+    out << "IR " << IR << endl;
+    out << "AC " << AC << endl;
+    out << "diagnostics " << diagnosticsCount << endl;
+    for (size_t i = 0; i < diagnostics.size(); i++)
+      out << "error " << diagnostics[i] << endl;
+    for (int i = nextOccupied(0); i < MEMSIZE; i = nextOccupied(i + 1))
+      out << completePC(i) << " " << data[i] << endl;
+  }
+}
+
+/*
+  Funcion que muestra la ejecución detenida: la pantalla de la animación con el estado actual y el motivo.
+  Parámetros: el motivo por el que terminó runToBreak().
+  Valor de retorno: ninguno.
+*/
+void showBreak(const string &status) {
+  screen.reset();
+  sim.drawFrame();
+
+  if(status == "break" && sim.breakReason == BREAK_ADDRESS)
+    cout << "Punto de interrupción en " << completePC(sim.PC);
+  else if(status == "break" && sim.breakReason == BREAK_WATCH)
+    cout << "La celda " << completePC(sim.breakCell) << " cambió de " << sim.breakOld << " a " << sim.data[sim.breakCell];
+  else if(status == "break")
+    cout << "El AC tomó el valor " << sim.AC;
+  else if(status == "step_limit")
+    cout << "Sin detenerse después de " << DEBUGMAXSTEPS << " instrucciones";
+  else if(status == "rewound")
+    cout << "Ejecución regresada a " << completePC(sim.PC);
+  else
+    cout << "El programa terminó";
+  cout << " (instrucción " << sim.steps << ")." << endl;
+
+  if(sim.diagnosticsCount > 0) {
+    cout << endl << sim.diagnosticsCount << " errores desde el alto anterior";
+    for(size_t i = 0; i < sim.diagnostics.size() && i < DEBUGSHOWERRORS; i++)
+      cout << (i ? ", " : ": ") << sim.diagnostics[i];
+    cout << (sim.diagnosticsCount > DEBUGSHOWERRORS ? ", ..." : "") << endl;
+  }
+}
+
+/*
+  Funcion que ejecuta hasta los puntos de interrupción desde la dirección 0. En cada alto se puede continuar
+  a toda velocidad hasta el siguiente o ver la animación de la siguiente instrucción.
+  Parámetros: ninguno.
+  Valor de retorno: ninguno.
+*/
+void debugProgram() {
+  sim.PC = 0;
+  sim.PCprev = 0;
+  sim.steps = 0;
+  sim.profile.reset();
+  sim.history.reset();
+  if(recordHistory) {
+    try {
+      sim.history.reset(new History(historyInterval, historyDeltas, historySnapshots));
+    } catch(const bad_alloc &) {
+      cout << "ERROR: no hay memoria para el historial; se depura sin historial." << endl;
+    }
+  }
+
+  string status = sim.runToBreak(false);
+  bool running = status == "break" || status == "step_limit";
+  showBreak(status);
+
+  while(running || sim.history) {
+    string option;
+    cout << endl;
+    if(running) {
+      cout << "  c Continuar hasta el siguiente alto" << endl;
+      cout << "  a Animar la siguiente instrucción" << endl;
+    }
+    if(sim.history)
+      cout << "  b Retroceder instrucciones" << endl;
+    cout << "  0 Detener" << endl;
+    cout << " => ";
+    cin >> option;
+
+    if(option == "c" && running) {
+      // Sólo un alto por celda vigilada o por el AC deja pendiente el punto de interrupción donde se detuvo.
+      status = sim.runToBreak(!(status == "break" && sim.breakReason != BREAK_ADDRESS));
+      running = status == "break" || status == "step_limit";
+    }
+    else if(option == "a" && running) {
+      // La animación ejecuta la instrucción aunque su celda tenga punto de interrupción.
+      sim.breakReason = BREAK_NONE;
+      running = sim.animate(1);
+      status = running ? "animated" : "halted";
+    }
+    else if(option == "b" && sim.history) {
+      long long n;
+      cout << endl << "Introduzca el número de instrucciones por retroceder: ";
+      cin >> n;
+      if(!sim.stepBack(max(0LL, n))) {
+        cout << endl << "ERROR: el historial no llega tan atrás";
+        if(sim.history->snapshotCount > 0)
+          cout << " (instantánea más vieja: instrucción " << sim.history->snapshot(0).steps << ")";
+        cout << "." << endl;
+        continue;
+      }
+      running = true;
+      status = "rewound";
+    }
+    else if(option == "0")
+      break;
+    else
+      continue;
+
+    if(status == "animated")
+      cout << endl << "Siguiente instrucción en " << completePC(sim.PC) << " (instrucción " << sim.steps << ")." << endl;
+    else
+      showBreak(status);
+  }
+  sim.history.reset();
+
+  cout << endl << "Presione cualquier tecla para regresar al menu..." << endl;
+  cin.ignore();
+  cin.get();
+  refreshScreen();
+}
+
+/*
+  Funcion que muestra el menú de depuración: puntos de interrupción, celdas vigiladas, valor del AC vigilado
+  y ejecución hasta los puntos de interrupción.
+  Parámetros: ninguno.
+  Valor de retorno: ninguno.
+*/
+void showDebugMenu() {
+  int option;
+  do {
+    cout << "Puntos de interrupción:";
+    for(int i = 0; i < MEMSIZE; i++) {
+      if(sim.isBreakpoint(i))
+        cout << " " << completePC(i);
+    }
+    cout << endl << "Celdas vigiladas:";
+    for(int i = 0; i < MEMSIZE; i++) {
+      if(sim.isWatched(i))
+        cout << " " << completePC(i);
+    }
+    cout << endl << "Valor vigilado del AC: ";
+    if(sim.watchAC)
+      cout << sim.watchACValue << endl;
+    else
+      cout << "(ninguno)" << endl;
+
+    cout << endl << "Seleccione una opcion:" << endl;
+    cout << "  1 Poner o quitar punto de interrupción" << endl;
+    cout << "  2 Vigilar o dejar de vigilar una celda" << endl;
+    cout << "  3 Vigilar un valor del AC" << endl;
+    cout << "  4 Ejecutar hasta los puntos de interrupción" << endl;
+    cout << "  5 " << getBoolX(recordHistory) << " Guardar historial para retroceder" << endl;
+    cout << "  6 [" << historyInterval << " / " << historySnapshots << " / " << historyDeltas
+         << "] Historial: instrucciones entre instantáneas / instantáneas / cambios guardados" << endl;
+    cout << "  0 Volver al menú principal" << endl;
+    cout << " => ";
+    cin >> option;
+    cout << endl;
+
+    if(option == 1 || option == 2) {
+      int dir;
+      cout << "Introduzca la dirección: ";
+      cin >> dir;
+      if(dir < 0 || dir >= MEMSIZE)
+        cout << "ERROR: la dirección no es válida." << endl;
+      else if(option == 1)
+        sim.toggleBreakpoint(dir);
+      else
+        sim.toggleWatch(dir);
+    }
+    else if(option == 3) {
+      string val;
+      cout << "Introduzca el valor (por ejemplo +00042; 0 para dejar de vigilar): ";
+      cin >> val;
+      sim.watchAC = parseWord(val, sim.watchACValue);
+    }
+    else if(option == 4)
+      debugProgram();
+    else if(option == 5)
+      recordHistory = !recordHistory;
+    else if(option == 6) {
+      cout << "Introduzca las instrucciones entre instantáneas, las instantáneas y los cambios (por ejemplo: 65536 64 65536): ";
+      long long interval, snapshots, deltas;
+      bool valid = false;
+      cin >> interval >> snapshots >> deltas;
+      if(!cin) {
+        cin.clear();
+        cout << "ERROR: se esperaban tres números." << endl;
+      }
+      else if(interval < 1 || snapshots < 1 || deltas < 1)
+        cout << "ERROR: los tres valores deben ser mayores que 0." << endl;
+      else if(snapshots > HISTORYBUDGET / (long long) sizeof(HistorySnapshot)
+              || deltas > HISTORYBUDGET / (long long) sizeof(HistoryDelta)
+              || snapshots * (long long) sizeof(HistorySnapshot) + deltas * (long long) sizeof(HistoryDelta) > HISTORYBUDGET)
+        cout << "ERROR: el historial ocuparía más de " << (HISTORYBUDGET >> 20) << " MB (cada instantánea ocupa "
+             << sizeof(HistorySnapshot) << " bytes y cada cambio " << sizeof(HistoryDelta) << ")." << endl;
+      else {
+        historyInterval = interval;
+        historySnapshots = snapshots;
+        historyDeltas = deltas;
+        valid = true;
+      }
+      if(!valid) {
+        cout << "Presione cualquier tecla para regresar al menu..." << endl;
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+        cin.get();
+      }
+    }
+
+    refreshScreen();
+
+  } while(option != 0);
+}
+
+// Función que muestra el menú, lee la opción del usuario y llama la función correspondiente,
+// repitiéndose hasta que el usuario desee salir.
+// Parámetros: ninguno.
+// Valor de retorno: ninguno.
+void showMenu() {
+  int option;
+
+  do {
+    cout << endl << "Seleccione una opcion:" << endl;
+    cout << "  1 Ver memoria\n";
+    cout << "  2 Editar dirección de memoria (valor)\n";
+    cout << "  3 Editar dirección de memoria (ensamblador)\n";
+    cout << "  4 Cargar archivo en memoria\n";
+    cout << "  5 Vaciar memoria\n";
+    cout << "  6 Configuración\n";
+    cout << "  7 Ejecutar programa\n";
+    cout << "  8 Depurar (puntos de interrupción)\n";
+    cout << "  9 Guardar memoria (imagen binaria)\n";
+    cout << "  0 Salir\n";
+    cout << " => ";
+    cin >> option;
+
+    cout << endl;
+
+    switch (option) {
+      case 1: {
+        showMemory();
+        break;
       }
-      else {
-        AC = completeAC(iTemp + iTemp2);
-        displayChanges();
+      case 2: {
+        editMemoryDirectly();
+        cout << "Presione cualquier tecla para regresar al menu..." << endl;
+        cin.ignore();
+        cin.get();
+        refreshScreen();
+        break;
       }
-      break;
-    }
-    // Indirecto
-    case '2': {
-    	MAR = sExtra;
-      displayChanges();
-    	iDir = atoi(MAR.c_str());
-      MDR = data[iDir]; // MMRead
-      displayChanges();
-      MAR = MDR;
-      displayChanges();
-      iDir = atoi(MAR.c_str());
-      MDR = data[iDir]; // MMRead
-      displayChanges();
-      iTemp = atoi(MDR.c_str());
-      iTemp2 = atoi(AC.c_str());
-      if (iTemp + iTemp2 > 99999 || iTemp + iTemp2 < -99999) {
-       	cout << "OVERFLOW" << endl;
+      case 3: {
+        editMemory();
+        cout << "Presione cualquier tecla para regresar al menu..." << endl;
+        cin.ignore();
+        cin.get();
+        refreshScreen();
+        break;
       }
-      else {
-        AC = completeAC(iTemp + iTemp2);
-        displayChanges();
+      case 4: {
+        loadFile();
+        break;
       }
-      break;
-    }
-    // Inmediato
-    case '3': {
-      iTemp = atoi(sExtra.c_str());
-      iTemp2 = atoi(AC.c_str());
-      if (iTemp + iTemp2 > 99999 || iTemp + iTemp2 < -99999) {
-       	cout << "OVERFLOW" << endl;
+      case 5: {
+        clearMemory();
+        cout << "Presione cualquier tecla para continuar..." << endl;
+        cin.ignore();
+        cin.get();
+        refreshScreen();
+        break;
       }
-      else {
-        AC = completeAC(iTemp + iTemp2);
-        displayChanges();
+      case 6: {
+        refreshScreen();
+        showOptions();
+        refreshScreen();
+        break;
+      }
+      case 7: {
+        if(profileExecution)
+          sim.profile.reset(new Profile());
+        else
+          sim.profile.reset();
+       	sim.execute();
+        cout << "Ejecución exitosa." << endl;
+        if(sim.profile) {
+          cout << endl;
+          sim.writeProfile(cout);
+          cout << endl << "Presione cualquier tecla para regresar al menu..." << endl;
+          cin.ignore();
+          cin.get();
+          refreshScreen();
+        }
+        else
+          this_thread::sleep_for(chrono::seconds(3));
+        break;
+      }
+      case 8: {
+        refreshScreen();
+        showDebugMenu();
+        break;
+      }
+      case 9: {
+        saveImageFile();
+        break;
+      }
+      case 0: {
+        break;
+      }
+      default: {
+        cout << endl << "Por favor seleccione una opción valida." << endl;
+        break;
       }
-      break;
     }
-    // Relativo
-    case '4': {
-     	iTemp = atoi(sExtra.c_str());
-      if (PC + iTemp < 0 || PC + iTemp > 999) {
-       	cout << "OUT OF BOUNDS" << endl;
+  } while(option != 0);
+}
+
+/*
+  Modo por lotes: ejecuta muchos programas en paralelo, cada uno en su propia máquina.
+
+  Los programas se reparten por turnos entre las colas de los hilos (el programa i va a la cola i % hilos).
+  Cada hilo toma los programas del frente de su cola, en orden; cuando se queda sin trabajo roba del final
+  de la cola de otro hilo, así que los programas largos no dejan hilos ociosos y los primeros programas
+  terminan primero. El hilo principal escribe los resultados en el orden de entrada conforme van estando listos,
+  así que la salida es la misma sin importar el número de hilos.
+*/
+
+// Opciones de ejecución de cada programa del lote.
+struct BatchOptions {
+  long long maxSteps;
+  Engine engine;
+  string format;
+  bool fusion;
+};
+
+// Cola de programas (índices) de un hilo del lote.
+struct BatchQueue {
+  mutex lock;
+  deque<size_t> tasks;
+};
+
+/*
+  Funcion que toma el siguiente programa para un hilo: del frente de su cola o, si está vacía,
+  robado del final de la cola de otro hilo.
+  Parámetros: las colas de todos los hilos, el número del hilo y dónde guardar el programa tomado.
+  Valor de retorno: false si ya no quedan programas en ninguna cola.
+*/
+bool takeBatchTask(vector<BatchQueue> &queues, size_t worker, size_t &task) {
+  {
+    lock_guard<mutex> guard(queues[worker].lock);
+    if (!queues[worker].tasks.empty()) {
+      task = queues[worker].tasks.front();
+      queues[worker].tasks.pop_front();
+      return true;
+    }
+  }
+
+  for (size_t k = 1; k < queues.size(); k++) {
+    BatchQueue &victim = queues[(worker + k) % queues.size()];
+    lock_guard<mutex> guard(victim.lock);
+    if (!victim.tasks.empty()) {
+      task = victim.tasks.back();
+      victim.tasks.pop_back();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/*
+  Funcion que carga y ejecuta un programa del lote en una máquina nueva.
+  Parámetros: el nombre del archivo, las opciones de ejecución y dónde escribir el estado final.
+  Valor de retorno: true si el programa se cargó sin errores.
+*/
+bool runBatchProgram(const string &fileName, const BatchOptions &options, string &result) {
+  unique_ptr<Machine> machine(new Machine());
+  machine->headlessMode = true;
+  machine->fusionEnabled = options.fusion;
+
+  ostringstream out, messages;
+  bool loaded = machine->loadProgramFile(fileName, messages);
+
+  if (!loaded) {
+    if (options.format == "json")
+      out << "{\n  \"program\": \"" << jsonEscape(fileName) << "\",\n  \"status\": \"load_error\"\n}" << endl;
+    else
+      out << "program " << fileName << endl << "status load_error" << endl;
+  } else {
+    string status = machine->runHeadless(options.maxSteps, options.engine);
+    machine->dumpState(out, options.format, status, fileName);
+  }
+
+  result = out.str();
+  return loaded;
+}
+
+/*
+  Funcion que obtiene la lista de programas del lote. Un directorio aporta sus archivos .txt y sus imágenes
+  .simg en orden alfabético.
+  Parámetros: los archivos y directorios dados en la linea de comandos y dónde guardar la lista.
+  Valor de retorno: false si algún directorio no se pudo leer.
+*/
+bool collectBatchFiles(const vector<string> &inputs, vector<string> &files) {
+  for (size_t i = 0; i < inputs.size(); i++) {
+    error_code ec;
+    if (!filesystem::is_directory(inputs[i], ec)) {
+      files.push_back(inputs[i]);
+      continue;
+    }
+
+    vector<string> entries;
+    for (filesystem::directory_iterator it(inputs[i], ec), end; !ec && it != end; it.increment(ec)) {
+      if (it->is_regular_file(ec) && (it->path().extension() == ".txt" || it->path().extension() == ".simg"))
+        entries.push_back(it->path().string());
+    }
+    if (ec) {
+      cerr << "No se pudo leer el directorio " << inputs[i] << endl;
+      return false;
+    }
+    sort(entries.begin(), entries.end());
+    files.insert(files.end(), entries.begin(), entries.end());
+  }
+  return true;
+}
+
+/*
+  Funcion que escribe el estado final de un programa del lote en su lugar de la salida.
+  En texto los resultados se separan con una línea vacía; en JSON forman un arreglo que cierra quien llama.
+  Parámetros: la posición del programa en el lote, su estado final y el formato.
+  Valor de retorno: ninguno.
+*/
+void writeBatchResult(size_t index, string result, string format) {
+  if (format == "json") {
+    result.erase(result.length() - 1);
+    cout << (index ? ",\n" : "[\n") << result;
+  } else {
+    cout << (index ? "\n" : "") << result;
+  }
+  cout.flush();
+}
+
+/*
+  Funcion que hace un conjunto de ejecuciones en el grupo de hilos del modo por lotes y escribe sus
+  resultados en orden conforme van estando listos.
+  Parámetros: el número de ejecuciones, la función que hace la ejecución i y escribe su resultado
+              (regresa false si falló la carga), el formato, el número de hilos (0 para usar uno por procesador)
+              y si se muestra el tiempo total.
+  Valor de retorno: codigo de salida (0 exito, 1 si alguna carga falló).
+*/
+int runInPool(size_t count, const function<bool(size_t, string &)> &task, string format, int jobs, bool showTime) {
+  size_t workers = jobs > 0 ? jobs : thread::hardware_concurrency();
+  if (workers == 0)
+    workers = 1;
+  if (workers > count)
+    workers = count;
+
+  vector<BatchQueue> queues(workers);
+  for (size_t i = 0; i < count; i++)
+    queues[i % workers].tasks.push_back(i);
+
+  // Resultados de cada ejecución; el hilo principal los escribe y libera en orden.
+  vector<string> results(count);
+  vector<char> done(count, 0), loaded(count, 0);
+  mutex resultLock;
+  condition_variable resultReady;
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  vector<thread> pool;
+  for (size_t w = 0; w < workers; w++) {
+    pool.push_back(thread([&, w]() {
+      size_t i;
+      while (takeBatchTask(queues, w, i)) {
+        string result;
+        bool ok = task(i, result);
+        {
+          lock_guard<mutex> guard(resultLock);
+          results[i].swap(result);
+          loaded[i] = ok;
+          done[i] = 1;
+        }
+        resultReady.notify_all();
       }
-      else {
-        if (PC + iTemp < 100) {
-          if (PC + iTemp < 10) {
-            MAR = "00" + toString(PC + iTemp);
-          }
-          else {
-            MAR = "0" + toString(PC + iTemp);
+    }));
+  }
+
+  bool allLoaded = true;
+  for (size_t i = 0; i < count; i++) {
+    string result;
+    {
+      unique_lock<mutex> guard(resultLock);
+      resultReady.wait(guard, [&]() { return done[i] != 0; });
+      result.swap(results[i]);
+      allLoaded = allLoaded && loaded[i];
+    }
+
+    writeBatchResult(i, result, format);
+  }
+  if (format == "json")
+    cout << "\n]" << endl;
+
+  for (size_t w = 0; w < workers; w++)
+    pool[w].join();
+
+  if (showTime) {
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cerr << count << " ejecuciones en " << elapsed << " s con " << workers << " hilos" << endl;
+  }
+
+  return allLoaded ? 0 : 1;
+}
+
+/*
+  Funcion que ejecuta un lote de programas en un grupo de hilos y escribe sus estados finales en orden.
+  Parámetros: los archivos y directorios del lote, las opciones de ejecución, el número de hilos
+              (0 para usar uno por procesador) y si se muestra el tiempo total.
+  Valor de retorno: codigo de salida (0 exito, 1 si algún programa no se pudo cargar).
+*/
+int runBatch(const vector<string> &inputs, const BatchOptions &options, int jobs, bool showTime) {
+  vector<string> files;
+  if (!collectBatchFiles(inputs, files))
+    return 1;
+  if (files.empty()) {
+    cerr << "No se encontraron programas por ejecutar." << endl;
+    return 1;
+  }
+
+  return runInPool(files.size(), [&](size_t i, string &result) { return runBatchProgram(files[i], options, result); },
+                   options.format, jobs, showTime);
+}
+
+/*
+  Motor SIMD por pasos sincronizados (--variants): ejecuta el mismo programa en muchas máquinas que sólo
+  difieren en algunas celdas (por ejemplo, los datos de entrada al calificar una tarea).
+
+  La memoria y los registros AC, MAR y MDR se guardan como estructura de arreglos: la celda c de la máquina l
+  está en mem[c * width + l], así que una instrucción con dirección fija (ABS, REL, INM) se ejecuta sobre
+  todas las máquinas con operaciones vectoriales (AVX2, SSE2 o escalares según el compilador).
+  PC, PCprev, IR y el contador de pasos son comunes mientras las máquinas avanzan juntas.
+
+  Una máquina se separa del grupo cuando deja de ejecutar lo mismo que la primera máquina activa (la guía):
+  al traer una celda que en ella contiene otra palabra, o cuando un JMP IND la lleva a otro destino.
+  Su estado se copia a una Machine y termina sola con el motor escalar elegido con --engine.
+*/
+#if defined(__AVX2__)
+#define SIMDWIDTH 8
+typedef __m256i VInt;
+static inline VInt vLoad(const int32_t *p) { return _mm256_loadu_si256((const __m256i *) p); }
+static inline void vStore(int32_t *p, VInt v) { _mm256_storeu_si256((__m256i *) p, v); }
+static inline VInt vSet(int32_t x) { return _mm256_set1_epi32(x); }
+static inline VInt vAdd(VInt a, VInt b) { return _mm256_add_epi32(a, b); }
+static inline VInt vSub(VInt a, VInt b) { return _mm256_sub_epi32(a, b); }
+static inline VInt vOr(VInt a, VInt b) { return _mm256_or_si256(a, b); }
+static inline VInt vAnd(VInt a, VInt b) { return _mm256_and_si256(a, b); }
+static inline VInt vGreater(VInt a, VInt b) { return _mm256_cmpgt_epi32(a, b); }
+static inline VInt vSelect(VInt mask, VInt a, VInt b) { return _mm256_blendv_epi8(b, a, mask); }
+static inline bool vAny(VInt mask) { return !_mm256_testz_si256(mask, mask); }
+#elif defined(__SSE2__)
+#define SIMDWIDTH 4
+typedef __m128i VInt;
+static inline VInt vLoad(const int32_t *p) { return _mm_loadu_si128((const __m128i *) p); }
+static inline void vStore(int32_t *p, VInt v) { _mm_storeu_si128((__m128i *) p, v); }
+static inline VInt vSet(int32_t x) { return _mm_set1_epi32(x); }
+static inline VInt vAdd(VInt a, VInt b) { return _mm_add_epi32(a, b); }
+static inline VInt vSub(VInt a, VInt b) { return _mm_sub_epi32(a, b); }
+static inline VInt vOr(VInt a, VInt b) { return _mm_or_si128(a, b); }
+static inline VInt vAnd(VInt a, VInt b) { return _mm_and_si128(a, b); }
+static inline VInt vGreater(VInt a, VInt b) { return _mm_cmpgt_epi32(a, b); }
+static inline VInt vSelect(VInt mask, VInt a, VInt b) { return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)); }
+static inline bool vAny(VInt mask) { return _mm_movemask_epi8(mask) != 0; }
+#else
+#define SIMDWIDTH 1
+typedef int32_t VInt;
+static inline VInt vLoad(const int32_t *p) { return *p; }
+static inline void vStore(int32_t *p, VInt v) { *p = v; }
+static inline VInt vSet(int32_t x) { return x; }
+static inline VInt vAdd(VInt a, VInt b) { return (int32_t) ((uint32_t) a + (uint32_t) b); }
+static inline VInt vSub(VInt a, VInt b) { return (int32_t) ((uint32_t) a - (uint32_t) b); }
+static inline VInt vOr(VInt a, VInt b) { return a | b; }
+static inline VInt vAnd(VInt a, VInt b) { return a & b; }
+static inline VInt vGreater(VInt a, VInt b) { return a > b ? -1 : 0; }
+static inline VInt vSelect(VInt mask, VInt a, VInt b) { return mask ? a : b; }
+static inline bool vAny(VInt mask) { return mask != 0; }
+#endif
+
+// Máscara de los carriles cuyo valor no es un dato (vacío, instrucción o fuera de rango).
+static inline VInt vNotData(VInt v) {
+  return vOr(vGreater(v, vSet(MAXVALUE)), vGreater(vSet(-MAXVALUE), v));
+}
+
+struct Lockstep {
+  int lanes, width;
+  vector<int32_t> mem, ac, mar, mdr;
+  // -1 en los carriles que siguen en el grupo y 0 en los que ya se separaron.
+  vector<int32_t> active;
+  int activeCount, leader;
+  int PC, PCprev;
+  Word IR;
+  long long steps, stepLimit;
+  vector<vector<string> > diagnostics;
+  vector<long long> diagnosticsCount;
+  // Instrucción predecodificada de la guía y si se sabe que todas las máquinas activas tienen la misma palabra.
+  DecodedInst decoded[MEMSIZE];
+  bool uniform[MEMSIZE];
+
+  // Opciones de las máquinas separadas y estado final escrito de cada máquina.
+  long long maxSteps;
+  Engine engine;
+  bool fusion;
+  string format, program;
+  vector<string> results;
+
+  /*
+    Constructor: copia el programa cargado a todas las máquinas y aplica las celdas de cada variante.
+    Parámetros: la máquina con el programa, las celdas (dirección y palabra) de cada variante y las opciones.
+  */
+  Lockstep(const Machine &base, const vector<vector<pair<int, Word> > > &variants, long long maxSteps_,
+           Engine engine_, bool fusion_, string format_, string program_)
+    : lanes(variants.size()), width((variants.size() + SIMDWIDTH - 1) / SIMDWIDTH * SIMDWIDTH),
+      mem(MEMSIZE * width), ac(width, WORD_EMPTY), mar(width, 0), mdr(width, WORD_EMPTY), active(width, 0),
+      activeCount(lanes), leader(0), PC(0), PCprev(0), IR(Word::empty()), steps(0),
+      diagnostics(lanes), diagnosticsCount(lanes, 0),
+      maxSteps(maxSteps_), engine(engine_), fusion(fusion_), format(format_), program(program_), results(lanes) {
+    stepLimit = maxSteps > 0 ? maxSteps : LLONG_MAX;
+    for (int c = 0; c < MEMSIZE; c++) {
+      for (int l = 0; l < width; l++)
+        mem[c * width + l] = base.data[c].bits;
+      decoded[c] = decodeWord(base.data[c]);
+      uniform[c] = true;
+    }
+    for (int l = 0; l < lanes; l++) {
+      active[l] = -1;
+      for (size_t k = 0; k < variants[l].size(); k++) {
+        mem[variants[l][k].first * width + l] = variants[l][k].second.bits;
+        uniform[variants[l][k].first] = false;
+      }
+    }
+  }
+
+  // Columna de la celda c: su palabra en cada máquina.
+  int32_t *cell(int c) { return &mem[c * width]; }
+
+  // Reporta un error de ejecución en una máquina (como Machine::reportError en modo sin menú).
+  void laneError(int l, string msg) {
+    if (diagnostics[l].size() < MAXDIAGNOSTICS)
+      diagnostics[l].push_back(toString(steps) + " " + msg);
+    diagnosticsCount[l]++;
+  }
+
+  // Suma un valor al acumulador de una máquina si no causa overflow.
+  void laneAccumulate(int l, int value) {
+    int iResult = Word::fromValue(ac[l]).value() + value;
+    if (iResult > MAXVALUE || iResult < -MAXVALUE)
+      laneError(l, "OVERFLOW");
+    else
+      ac[l] = iResult;
+  }
+
+  // Direccionamiento indirecto en una máquina: MAR = [p], MDR = mem[p], MAR = MDR.
+  bool laneIndirect(int l, int p) {
+    mar[l] = p;
+    mdr[l] = cell(p)[l];
+    mar[l] = Word::fromValue(mdr[l]).value();
+    if (mar[l] < 0 || mar[l] >= MEMSIZE) {
+      laneError(l, "OUT OF BOUNDS");
+      return false;
+    }
+    return true;
+  }
+
+  /*
+    Funcion que copia el estado de una máquina del grupo a una Machine y escribe su estado final.
+    Si la máquina se separó antes de terminar, primero la termina con el motor escalar.
+    Parámetros: el carril, su PC y PCprev, y el motivo por el que terminó ("" si todavía no termina).
+  */
+  void finishLane(int l, int pc, int pcPrev, string status) {
+    unique_ptr<Machine> m(new Machine());
+    m->headlessMode = true;
+    m->fusionEnabled = fusion;
+    for (int c = 0; c < MEMSIZE; c++)
+      m->data[c] = Word::fromValue(cell(c)[l]);
+    m->decodeMemory();
+    m->PC = pc;
+    m->PCprev = pcPrev;
+    m->MAR = mar[l];
+    m->MDR = Word::fromValue(mdr[l]);
+    m->AC = Word::fromValue(ac[l]);
+    m->IR = IR;
+    m->steps = steps;
+    m->diagnostics.swap(diagnostics[l]);
+    m->diagnosticsCount = diagnosticsCount[l];
+
+    if (status == "")
+      status = m->resume(maxSteps, engine);
+
+    ostringstream out;
+    m->dumpState(out, format, status, program + "#" + toString(l + 1));
+    results[l] = out.str();
+  }
+
+  // Separa una máquina del grupo y la termina sola.
+  void eject(int l, int pc, int pcPrev) {
+    finishLane(l, pc, pcPrev, "");
+    active[l] = 0;
+    activeCount--;
+    while (leader < lanes && !active[leader])
+      leader++;
+  }
+
+  // Separa las máquinas cuya celda c no es igual a la de la guía; después la celda es uniforme.
+  void unifyCell(int c) {
+    int32_t *w = cell(c);
+    for (int l = leader + 1; l < lanes; l++) {
+      if (active[l] && w[l] != w[leader])
+        eject(l, PC, PCprev);
+    }
+    decoded[c] = decodeWord(Word::fromValue(w[leader]));
+    uniform[c] = true;
+  }
+
+  // MAR = t en todas las máquinas.
+  void setMAR(int t) {
+    VInt vt = vSet(t);
+    for (int i = 0; i < width; i += SIMDWIDTH)
+      vStore(&mar[i], vt);
+  }
+
+  // MAR = t y MDR = mem[t] en todas las máquinas.
+  void loadOperand(int t) {
+    VInt vt = vSet(t);
+    int32_t *w = cell(t);
+    for (int i = 0; i < width; i += SIMDWIDTH) {
+      vStore(&mar[i], vt);
+      vStore(&mdr[i], vLoad(w + i));
+    }
+  }
+
+  // AC = MDR en todas las máquinas.
+  void loadAC() {
+    for (int i = 0; i < width; i += SIMDWIDTH)
+      vStore(&ac[i], vLoad(&mdr[i]));
+  }
+
+  // AC = k en todas las máquinas.
+  void setAC(int k) {
+    VInt vk = vSet(k);
+    for (int i = 0; i < width; i += SIMDWIDTH)
+      vStore(&ac[i], vk);
+  }
+
+  /*
+    Suma (o resta) al acumulador de todas las máquinas el operando en MDR o, si inmediato, la constante k.
+    Un bloque de carriles en el que algún operando no es un dato se resuelve carril por carril con value().
+  */
+  void arith(bool add, bool immediate, int k) {
+    VInt vk = vSet(k), vMax = vSet(MAXVALUE), vMin = vSet(-MAXVALUE);
+    for (int i = 0; i < width; i += SIMDWIDTH) {
+      VInt act = vLoad(&active[i]);
+      VInt a = vLoad(&ac[i]);
+      VInt b = immediate ? vk : vLoad(&mdr[i]);
+      if (vAny(vAnd(act, vOr(vNotData(a), vNotData(b))))) {
+        for (int l = i; l < i + SIMDWIDTH; l++) {
+          if (active[l]) {
+            int value = immediate ? k : Word::fromValue(mdr[l]).value();
+            laneAccumulate(l, add ? value : -value);
           }
         }
-        else {
-          MAR = toString(PC + iTemp);
+        continue;
+      }
+      VInt r = add ? vAdd(a, b) : vSub(a, b);
+      VInt overflow = vOr(vGreater(r, vMax), vGreater(vMin, r));
+      vStore(&ac[i], vSelect(overflow, a, r));
+      if (vAny(vAnd(act, overflow))) {
+        int32_t mask[SIMDWIDTH];
+        vStore(mask, vAnd(act, overflow));
+        for (int j = 0; j < SIMDWIDTH; j++) {
+          if (mask[j])
+            laneError(i + j, "OVERFLOW");
         }
-        displayChanges();
-        MDR = data[PC + iTemp]; // MMRead
-        displayChanges();
-        iTemp = atoi(MDR.c_str());
-        iTemp2 = atoi(AC.c_str());
-        AC = completeAC(iTemp + iTemp2);
-        displayChanges();
       }
-      break;
     }
-    default: {
-     	cout << "INSTRUCCION NO VALIDA" << endl;
+  }
+
+  // AC = -AC en todas las máquinas (carril por carril con value() si algún acumulador no es un dato).
+  void negate() {
+    VInt zero = vSet(0);
+    for (int i = 0; i < width; i += SIMDWIDTH) {
+      VInt a = vLoad(&ac[i]);
+      if (vAny(vAnd(vLoad(&active[i]), vNotData(a)))) {
+        for (int l = i; l < i + SIMDWIDTH; l++) {
+          if (active[l])
+            ac[l] = -Word::fromValue(ac[l]).value();
+        }
+      } else {
+        vStore(&ac[i], vSub(zero, a));
+      }
+    }
+  }
+
+  // MAR = t, MDR = AC y mem[t] = MDR en todas las máquinas.
+  void store(int t) {
+    VInt vt = vSet(t);
+    int32_t *w = cell(t);
+    for (int i = 0; i < width; i += SIMDWIDTH) {
+      VInt a = vLoad(&ac[i]);
+      vStore(&mar[i], vt);
+      vStore(&mdr[i], a);
+      vStore(w + i, a);
+    }
+    // Se revisa otra vez si todas las máquinas tienen la misma palabra cuando se ejecute la celda.
+    uniform[t] = false;
+  }
+
+  // Operación con direccionamiento indirecto, carril por carril (op: 2 LDA, 3 STA, 4 ADD, 5 SUB).
+  void indirect(int op, int p) {
+    for (int l = leader; l < lanes; l++) {
+      if (!active[l] || !laneIndirect(l, p))
+        continue;
+      if (op == 3) {
+        mdr[l] = ac[l];
+        cell(mar[l])[l] = mdr[l];
+        uniform[mar[l]] = false;
+      } else {
+        mdr[l] = cell(mar[l])[l];
+        if (op == 2)
+          ac[l] = mdr[l];
+        else
+          laneAccumulate(l, op == 4 ? Word::fromValue(mdr[l]).value() : -Word::fromValue(mdr[l]).value());
+      }
+    }
+  }
+
+  // JMP IND: cada máquina calcula su destino; las que no van al mismo lugar que la guía se separan.
+  void jumpIndirect(int p) {
+    int pc = PC, pcPrev = PCprev;
+    int leaderPC = PC, leaderPrev = PCprev;
+    for (int l = leader; l < lanes; l++) {
+      if (!active[l])
+        continue;
+      int lanePC = pc, lanePrev = pcPrev;
+      if (laneIndirect(l, p)) {
+        mdr[l] = cell(mar[l])[l];
+        lanePrev = pc;
+        lanePC = Word::fromValue(mdr[l]).value();
+      }
+      if (l == leader) {
+        leaderPC = lanePC;
+        leaderPrev = lanePrev;
+      } else if (lanePC != leaderPC || lanePrev != leaderPrev) {
+        eject(l, lanePC, lanePrev);
+      }
+    }
+    PC = leaderPC;
+    PCprev = leaderPrev;
+  }
+
+  // Reporta el mismo error en todas las máquinas activas.
+  void allLanesError(string msg) {
+    for (int l = leader; l < lanes; l++) {
+      if (active[l])
+        laneError(l, msg);
+    }
+  }
+
+  // Dirección relativa común a todas las máquinas; reporta el error en todas si sale de la memoria.
+  bool relative(int t) {
+    if (t >= 0 && t < MEMSIZE)
+      return true;
+    allLanesError("OUT OF BOUNDS");
+    return false;
+  }
+
+  /*
+    Funcion que ejecuta el grupo hasta que termina o se separan todas las máquinas, y después escribe
+    el estado final de las máquinas que terminaron juntas.
+    Parámetros: ninguno.
+    Valor de retorno: ninguno.
+  */
+  void run() {
+    string status = "end_of_memory";
+
+    while ((unsigned) PC < MEMSIZE && activeCount > 0) {
+      if (steps >= stepLimit) {
+        status = "step_limit";
+        break;
+      }
+      if (!uniform[PC])
+        unifyCell(PC);
+
+      const DecodedInst &d = decoded[PC];
+      int p = d.param;
+      IR = Word::fromValue(cell(PC)[leader]);
+      steps++;
+
+      bool jump = d.handler == H_JMP_ABS || d.handler == H_JMP_IND || d.handler == H_JMP_REL || d.handler == H_JMP_INVALID;
+      if (!jump)
+        PCprev = PC++;
+
+      switch (d.handler) {
+        case H_CLA: setAC(0); break;
+        case H_NEG: negate(); break;
+        case H_LDA_ABS: loadOperand(p); loadAC(); break;
+        case H_LDA_INM: setAC(p); break;
+        case H_LDA_REL: if (relative(PC + p)) { loadOperand(PC + p); loadAC(); } break;
+        case H_STA_ABS: store(p); break;
+        case H_STA_REL: if (relative(PC + p)) store(PC + p); break;
+        case H_ADD_ABS: loadOperand(p); arith(true, false, 0); break;
+        case H_ADD_INM: arith(true, true, p); break;
+        case H_ADD_REL: if (relative(PC + p)) { loadOperand(PC + p); arith(true, false, 0); } break;
+        case H_SUB_ABS: loadOperand(p); arith(false, false, 0); break;
+        case H_SUB_INM: arith(false, true, p); break;
+        case H_SUB_REL: if (relative(PC + p)) { loadOperand(PC + p); arith(false, false, 0); } break;
+        case H_LDA_IND: indirect(2, p); break;
+        case H_STA_IND: indirect(3, p); break;
+        case H_ADD_IND: indirect(4, p); break;
+        case H_SUB_IND: indirect(5, p); break;
+        case H_JMP_ABS:
+          PCprev = PC;
+          PC = p;
+          break;
+        case H_JMP_REL:
+          if (relative(PC + p)) {
+            setMAR(PC + p);
+            PCprev = PC;
+            PC += p;
+          }
+          break;
+        case H_JMP_IND: jumpIndirect(p); break;
+        case H_INVALID: allLanesError("INSTRUCCION NO VALIDA"); break;
+        case H_JMP_INVALID: allLanesError("INPUT ERROR"); break;
+        case H_HLT: status = "halted"; break;
+      }
+      if (d.handler == H_HLT)
+        break;
+    }
+
+    for (int l = leader; l < lanes; l++) {
+      if (active[l])
+        finishLane(l, PC, PCprev, status);
+    }
+  }
+};
+
+/*
+  Funcion que lee el archivo de variantes del motor SIMD. Cada línea que no está vacía ni empieza con '#'
+  es una máquina y contiene las celdas que cambian respecto al programa, como DIRECCION=PALABRA
+  con la palabra en lenguaje máquina (por ejemplo: 010=+00042 011=020005).
+  Parámetros: el nombre del archivo y dónde guardar las celdas de cada variante.
+  Valor de retorno: false si el archivo no se pudo leer o alguna celda no es válida.
+*/
+bool loadVariants(string fileName, vector<vector<pair<int, Word> > > &variants) {
+  ifstream file(fileName.c_str());
+  if (!file.is_open()) {
+    cerr << "No se pudo abrir el archivo " << fileName << endl;
+    return false;
+  }
+
+  string line, item;
+  for (int lineNumber = 1; getline(file, line); lineNumber++) {
+    istringstream items(line);
+    if (!(items >> item) || item[0] == '#')
+      continue;
+
+    vector<pair<int, Word> > cells;
+    do {
+      size_t eq = item.find('=');
+      string dir = item.substr(0, eq);
+      Word w;
+      if (eq == string::npos || dir.empty() || dir.length() > ADDRDIGITS || dir.find_first_not_of("0123456789") != string::npos
+          || !parseWord(item.substr(eq + 1), w)) {
+        cerr << fileName << ":" << lineNumber << ": celda no válida: " << item << endl;
+        return false;
+      }
+      cells.push_back(make_pair(atoi(dir.c_str()), w));
+    } while (items >> item);
+    variants.push_back(cells);
+  }
+
+  if (variants.empty()) {
+    cerr << "El archivo " << fileName << " no tiene variantes." << endl;
+    return false;
+  }
+  return true;
+}
+
+/*
+  Funcion que ejecuta un programa con cada variante del archivo en el motor SIMD y escribe sus estados
+  finales en orden (como el modo por lotes).
+  Parámetros: el programa ya cargado, su nombre, el archivo de variantes, las opciones de ejecución
+              y si se muestra el tiempo total.
+  Valor de retorno: codigo de salida (0 exito, 1 si el archivo de variantes no es válido).
+*/
+int runVariants(const Machine &base, string fileName, string variantsFile, const BatchOptions &options, bool showTime) {
+  vector<vector<pair<int, Word> > > variants;
+  if (!loadVariants(variantsFile, variants))
+    return 1;
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  unique_ptr<Lockstep> group(new Lockstep(base, variants, options.maxSteps, options.engine, options.fusion,
+                                          options.format, fileName));
+  group->run();
+
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  for (size_t i = 0; i < group->results.size(); i++)
+    writeBatchResult(i, group->results[i], options.format);
+  if (options.format == "json")
+    cout << "\n]" << endl;
+
+  if (showTime)
+    cerr << variants.size() << " máquinas en " << elapsed << " s (" << SIMDWIDTH << " carriles por vector)" << endl;
+
+  return 0;
+}
+
+// Memoria máxima de las máquinas hijas que existen a la vez en --fork-at (limita los hilos).
+#define FORKBUDGET (1LL << 30)
+
+/*
+  Funcion que ejecuta un programa hasta el paso K y bifurca su estado en una máquina por variante, que
+  continúan en paralelo en el grupo de hilos del modo por lotes. Las celdas de cada variante se escriben
+  en el paso K, y los hijos no vuelven a cargar el programa ni a ejecutar los primeros K pasos.
+  Parámetros: el programa ya cargado, su nombre, el archivo de variantes, el paso K, las opciones de ejecución
+              (el límite de pasos cuenta desde el inicio del programa), el número de hilos y si se muestra el tiempo.
+  Valor de retorno: codigo de salida (0 exito, 1 si el archivo de variantes no es válido o el programa
+                    terminó antes del paso K).
+*/
+int runForks(Machine &base, string fileName, string variantsFile, long long forkAt, const BatchOptions &options,
+             int jobs, bool showTime) {
+  vector<vector<pair<int, Word> > > variants;
+  if (!loadVariants(variantsFile, variants))
+    return 1;
+
+  // Cada hilo tiene a lo más un hijo vivo, y cada hijo es una máquina completa (ver Machine::fork).
+  int maxChildren = (int) max(1LL, FORKBUDGET / (long long) sizeof(Machine));
+  int workers = jobs > 0 ? jobs : (int) thread::hardware_concurrency();
+  if (workers > maxChildren && variants.size() > (size_t) maxChildren) {
+    cerr << "Se usan " << maxChildren << " hilos: cada bifurcación ocupa " << (sizeof(Machine) >> 20) << " MB." << endl;
+    jobs = maxChildren;
+  }
+
+  string status = base.runHeadless(forkAt, options.engine);
+  if (status != "step_limit") {
+    cerr << "El programa terminó (" << status << ") antes del paso " << forkAt << "." << endl;
+    return 1;
+  }
+
+  return runInPool(variants.size(), [&](size_t i, string &result) {
+    unique_ptr<Machine> child = base.fork(variants[i]);
+    string childStatus = child->resume(options.maxSteps, options.engine);
+    ostringstream out;
+    child->dumpState(out, options.format, childStatus, fileName + "#" + toString(i + 1));
+    result = out.str();
+    return true;
+  }, options.format, jobs, showTime);
+}
+
+/*
+  Modo de medición (--benchmark): ejecuta cada programa de un directorio (por omisión benchmarks/) con cada motor
+  y reporta instrucciones por segundo, microoperaciones por segundo, el tiempo de carga y la memoria máxima.
+  Los programas de benchmarks/ son ciclos que no terminan (se detienen con el límite de pasos):
+    add_loop.txt  ciclo corto de ADD/SUB ABS e INM con JMP ABS,
+    indirect.txt  LDA/ADD/SUB/STA IND y JMP IND a través de una tabla de apuntadores,
+    selfmod.txt   STA que reescribe instrucciones del propio ciclo antes de ejecutarlas,
+    relative.txt  recorrido con LDA/ADD/SUB/STA REL y JMP REL.
+  Todos los motores ejecutan las mismas instrucciones, así que las microoperaciones (que sólo cuenta el motor
+  clásico, una por cada cambio que mostraría la animación) se dividen entre el tiempo de cada motor.
+*/
+
+// Repeticiones de la carga para medir su tiempo.
+#define LOADREPEAT 100
+
+/*
+  Contadores del procesador (perf_event_open, sólo en Linux) que se leen alrededor de cada ejecución de la
+  medición: ciclos, instrucciones, fallos de predicción de saltos y fallos de lectura de la caché L1 de datos.
+  Sólo cuentan en modo usuario, así que bastan los permisos por omisión (perf_event_paranoid <= 2).
+  Un contador que el sistema no permite abrir (máquinas virtuales, contenedores) queda en -1.
+  Si el sistema multiplexa los contadores, el valor se escala al tiempo total de la ejecución.
+*/
+enum HostCounter { HC_CYCLES, HC_INSTRUCTIONS, HC_BRANCHMISSES, HC_L1DMISSES, HOSTCOUNTERS };
+// Nombres de los contadores en JSON, en el mismo orden que HostCounter.
+const char *hostCounterNames[HOSTCOUNTERS] = {"cycles", "instructions", "branchMisses", "l1dMisses"};
+
+struct HostCounters {
+  int fds[HOSTCOUNTERS];
+  long long values[HOSTCOUNTERS];
+
+  HostCounters();
+  ~HostCounters();
+  HostCounters(const HostCounters &) = delete;
+  HostCounters &operator=(const HostCounters &) = delete;
+  bool available() const;
+  void start();
+  void stop();
+};
+
+// Constructor: abre los contadores del hilo actual, detenidos.
+HostCounters::HostCounters() {
+  for (int c = 0; c < HOSTCOUNTERS; c++) {
+    fds[c] = -1;
+    values[c] = -1;
+  }
+#ifdef __linux__
+  const uint32_t types[HOSTCOUNTERS] = {PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE};
+  const uint64_t configs[HOSTCOUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES,
+    PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+  };
+  for (int c = 0; c < HOSTCOUNTERS; c++) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = types[c];
+    attr.config = configs[c];
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    fds[c] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+#endif
+}
+
+// Destructor: cierra los contadores abiertos.
+HostCounters::~HostCounters() {
+  for (int c = 0; c < HOSTCOUNTERS; c++) {
+    if (fds[c] >= 0)
+      close(fds[c]);
+  }
+}
+
+// Regresa true si se pudo abrir al menos un contador.
+bool HostCounters::available() const {
+  for (int c = 0; c < HOSTCOUNTERS; c++) {
+    if (fds[c] >= 0)
+      return true;
+  }
+  return false;
+}
+
+// Pone en cero y arranca los contadores.
+void HostCounters::start() {
+#ifdef __linux__
+  for (int c = 0; c < HOSTCOUNTERS; c++) {
+    if (fds[c] >= 0) {
+      ioctl(fds[c], PERF_EVENT_IOC_RESET, 0);
+      ioctl(fds[c], PERF_EVENT_IOC_ENABLE, 0);
     }
   }
+#endif
+}
+
+// Detiene los contadores y guarda sus valores en values.
+void HostCounters::stop() {
+#ifdef __linux__
+  for (int c = 0; c < HOSTCOUNTERS; c++) {
+    if (fds[c] >= 0)
+      ioctl(fds[c], PERF_EVENT_IOC_DISABLE, 0);
+  }
+  for (int c = 0; c < HOSTCOUNTERS; c++) {
+    // Valor, tiempo habilitado y tiempo contando.
+    uint64_t buf[3];
+    values[c] = -1;
+    if (fds[c] >= 0 && read(fds[c], buf, sizeof buf) == sizeof buf && buf[2] > 0)
+      values[c] = (long long) (buf[0] * ((double) buf[1] / buf[2]));
+  }
+#endif
 }
 
 /*
-  Funcion que realiza la operacion SUB.
-  Parametros: el tipo de direccionamiento y el parametro de la instruccion ([IR]2-0).
-  Valor de retorno: ninguno.
+  Funcion que obtiene la memoria máxima que ha usado el proceso.
+  Parámetros: ninguno.
+  Valor de retorno: la memoria residente máxima en KB (0 si el sistema no la reporta).
 */
-void opSUB(string sDireccionamiento, string sExtra) {
-	int iDir, iTemp, iTemp2;
-  string sContenido;
+long peakRssKB() {
+#ifdef _WIN32
+  return 0;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+#endif
+}
 
-  switch (sDireccionamiento[0]) {
-    // Absoluto
-    case '1': {
-     	MAR = sExtra;
-      displayChanges();
-      iDir = atoi(MAR.c_str());
-      MDR = data[iDir]; // MMRead
-      displayChanges();
-      iTemp = atoi(MDR.c_str());
-      iTemp2 = atoi(AC.c_str());
-      if (iTemp2 - iTemp > 99999 || iTemp2 - iTemp < -99999) {
-       	cout << "OVERFLOW" << endl;
-      }
-      else {
-        AC = completeAC(iTemp2 - iTemp);
-        displayChanges();
-      }
-      break;
-    }
-    // Indirecto
-    case '2': {
-    	MAR = sExtra;
-      displayChanges();
-    	iDir = atoi(MAR.c_str());
-      MDR = data[iDir]; // MMRead
-      displayChanges();
-      MAR = MDR;
-      displayChanges();
-      iDir = atoi(MAR.c_str());
-      MDR = data[iDir]; // MMRead
-      displayChanges();
-      iTemp = atoi(MDR.c_str());
-      iTemp2 = atoi(AC.c_str());
-      if (iTemp2 - iTemp > 99999 || iTemp2 - iTemp < -99999) {
-       	cout << "OVERFLOW" << endl;
-      }
-      else {
-        AC = completeAC(iTemp2 - iTemp);
-        displayChanges();
+/*
+  Funcion que carga un programa de la medición en una máquina.
+  Parámetros: el nombre del archivo y la máquina.
+  Valor de retorno: true si el programa se cargó sin errores.
+*/
+bool loadBenchmark(const string &fileName, Machine &machine) {
+  ostringstream messages;
+  return machine.loadProgramFile(fileName, messages);
+}
+
+/*
+  Funcion que mide los programas con los motores pedidos y escribe los resultados en texto o JSON.
+  Parámetros: los archivos y directorios por medir, el número de pasos por ejecución, los motores,
+              si se usan superinstrucciones y el formato.
+  Valor de retorno: codigo de salida (0 exito, 1 si algún programa no se pudo cargar).
+*/
+int runBenchmarks(const vector<string> &inputs, long long steps, const vector<Engine> &engines, bool fusion,
+                  string format) {
+  vector<string> files;
+  if (!collectBatchFiles(inputs, files))
+    return 1;
+  if (files.empty()) {
+    cerr << "No se encontraron programas por medir." << endl;
+    return 1;
+  }
+
+  bool json = format == "json";
+  if (!HostCounters().available())
+    cerr << "No se pudieron abrir los contadores del procesador (perf_event_open); se omiten." << endl;
+  if (json)
+    cout << "{\n  \"steps\": " << steps << ",\n  \"benchmarks\": [";
+
+  for (size_t f = 0; f < files.size(); f++) {
+    string name = filesystem::path(files[f]).stem().string();
+
+    // Tiempo de carga (lectura, ensamblado y predecodificación), promedio de LOADREPEAT cargas.
+    unique_ptr<Machine> machine(new Machine());
+    machine->headlessMode = true;
+    machine->fusionEnabled = fusion;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int r = 0; r < LOADREPEAT; r++) {
+      if (!loadBenchmark(files[f], *machine)) {
+        cerr << "No se pudo cargar el programa " << files[f] << endl;
+        return 1;
       }
-      break;
     }
-    // Inmediato
-    case '3': {
-      iTemp = atoi(sExtra.c_str());
-      iTemp2 = atoi(AC.c_str());
-      if (iTemp2 - iTemp > 99999 || iTemp2 - iTemp < -99999) {
-       	cout << "OVERFLOW" << endl;
-      }
-      else {
-        AC = completeAC(iTemp2 - iTemp);
-        displayChanges();
-      }
-      break;
+    double loadMicros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count() / LOADREPEAT;
+
+    // Microoperaciones de la ejecución, contadas con el motor clásico.
+    machine->runHeadless(steps, ENGINE_CLASSIC);
+    long long microops = machine->microops, classicSteps = machine->steps;
+
+    if (json) {
+      cout << (f ? ",\n" : "\n") << "    {\"name\": \"" << jsonEscape(name) << "\", \"file\": \"" << jsonEscape(files[f])
+           << "\", \"loadMicros\": " << fixed << setprecision(2) << loadMicros << ", \"microops\": " << microops
+           << ",\n     \"engines\": [";
+    } else {
+      cout << name << " (" << files[f] << "): carga " << fixed << setprecision(2) << loadMicros << " us, "
+           << microops << " microoperaciones" << endl;
     }
-    // Relativo
-    case '4': {
-     	iTemp = atoi(sExtra.c_str());
-      if (PC + iTemp < 0 || PC + iTemp > 999) {
-       	cout << "OUT OF BOUNDS" << endl;
-      }
-      else {
-        if (PC + iTemp < 100) {
-          if (PC + iTemp < 10) {
-            MAR = "00" + toString(PC + iTemp);
-          }
-          else {
-            MAR = "0" + toString(PC + iTemp);
-          }
+
+    for (size_t e = 0; e < engines.size(); e++) {
+      unique_ptr<Machine> run(new Machine());
+      run->headlessMode = true;
+      run->fusionEnabled = fusion;
+      loadBenchmark(files[f], *run);
+
+      HostCounters counters;
+      counters.start();
+      start = chrono::steady_clock::now();
+      string status = run->runHeadless(steps, engines[e]);
+      double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+      counters.stop();
+
+      double instrPerSec = seconds > 0 ? run->steps / seconds : 0;
+      // Si el motor no ejecutó los mismos pasos que el clásico sus microoperaciones no se conocen.
+      double microopsPerSec = seconds > 0 && run->steps == classicSteps ? microops / seconds : 0;
+
+      if (json) {
+        cout << (e ? ",\n" : "\n") << "       {\"engine\": \"" << engineNames[engines[e]] << "\", \"status\": \"" << status
+             << "\", \"steps\": " << run->steps << ", \"seconds\": " << setprecision(6) << seconds
+             << ", \"instrPerSec\": " << setprecision(0) << instrPerSec
+             << ", \"microopsPerSec\": " << microopsPerSec << ",\n        \"host\": {";
+        for (int c = 0; c < HOSTCOUNTERS; c++) {
+          cout << (c ? ", " : "") << "\"" << hostCounterNames[c] << "\": ";
+          if (counters.values[c] < 0)
+            cout << "null";
+          else
+            cout << counters.values[c];
         }
-        else {
-          MAR = toString(PC + iTemp);
+        cout << ", \"cyclesPerInstr\": ";
+        if (counters.values[HC_CYCLES] < 0 || run->steps == 0)
+          cout << "null";
+        else
+          cout << setprecision(3) << double(counters.values[HC_CYCLES]) / run->steps;
+        cout << "}}";
+      } else {
+        cout << "  " << left << setw(8) << setfill(' ') << engineNames[engines[e]] << right
+             << setw(12) << run->steps << " instr " << setprecision(3) << setw(9) << seconds << " s "
+             << setprecision(1) << setw(9) << instrPerSec / 1e6 << " M instr/s "
+             << setw(9) << microopsPerSec / 1e6 << " M microops/s" << endl;
+        // Contadores del procesador por instrucción simulada.
+        if (counters.available() && run->steps > 0) {
+          const char *labels[HOSTCOUNTERS] = {"ciclos", "instr", "fallos de salto", "fallos L1d"};
+          cout << "  " << setw(20) << "por instr:";
+          for (int c = 0; c < HOSTCOUNTERS; c++) {
+            if (counters.values[c] >= 0)
+              cout << " " << setprecision(2) << double(counters.values[c]) / run->steps << " " << labels[c];
+            else
+              cout << " " << labels[c] << " n/d";
+            cout << (c + 1 < HOSTCOUNTERS ? "," : "");
+          }
+          cout << endl;
         }
-        displayChanges();
-        MDR = data[PC + iTemp]; // MMRead
-        displayChanges();
-        iTemp = atoi(MDR.c_str());
-        iTemp2 = atoi(AC.c_str());
-        AC = completeAC(iTemp2 - iTemp);
-        displayChanges();
       }
-      break;
     }
-    default: {
-     	cout << "INSTRUCCION NO VALIDA" << endl;
+
+    if (json)
+      cout << "\n     ],\n     \"peakRssKB\": " << peakRssKB() << "}";
+    else
+      cout << "  memoria máxima " << peakRssKB() << " KB" << endl << endl;
+  }
+
+  if (json)
+    cout << "\n  ],\n  \"peakRssKB\": " << peakRssKB() << "\n}" << endl;
+
+  return 0;
+}
+
+/*
+  Funcion que obtiene un motor a partir de su nombre en la linea de comandos.
+  Parámetros: el nombre y dónde guardar el motor.
+  Valor de retorno: false si el nombre no es de ningún motor.
+*/
+bool parseEngine(string name, Engine &engine) {
+  for (int e = 0; e < ENGINECOUNT; e++) {
+    if (name == engineNames[e]) {
+      engine = (Engine) e;
+      return true;
     }
   }
+  return false;
 }
 
 /*
-  Funcion que realiza la operacion NEG.
-  Parametros: ninguno.
+  Funcion que muestra como usar el simulador desde la linea de comandos.
+  Parámetros: el nombre del ejecutable.
   Valor de retorno: ninguno.
 */
-void opNEG() {
-	int iTemp;
-  iTemp = atoi(AC.c_str());
-  iTemp *= -1;
-  AC = completeAC(iTemp);
-  displayChanges();
+void showUsage(string progName) {
+  cerr << "Uso: " << progName << " [programa.txt [opciones]]" << endl;
+  cerr << "     " << progName << " --batch programa.txt|directorio... [opciones]" << endl;
+  cerr << "     " << progName << " --replay trazo [--at N] [--animate K] [--format FMT]" << endl;
+  cerr << "  Sin argumentos se muestra el menú interactivo." << endl;
+  cerr << "  Con un programa se ejecuta sin menú y se escribe el estado final (- lee el programa de la entrada" << endl;
+  cerr << "  estándar)." << endl;
+  cerr << "  Con --batch se ejecutan en paralelo todos los programas dados (de un directorio, sus archivos .txt)" << endl;
+  cerr << "  y se escriben sus estados finales en el mismo orden." << endl << endl;
+  cerr << "Opciones:" << endl;
+  cerr << "  -n, --steps N       Límite de instrucciones por ejecutar (0 = sin límite, por omisión)" << endl;
+  cerr << "  -f, --format FMT    Formato de salida: text (por omisión) o json" << endl;
+  cerr << "  -e, --engine MOTOR  Motor de ejecución: goto (por omisión), jit, table o classic" << endl;
+  cerr << "      --no-fusion     No usar superinstrucciones en los motores table y goto" << endl;
+  cerr << "      --aot ARCHIVO   Escribir la traducción del programa a C++ en ARCHIVO en vez de ejecutarlo" << endl;
+  cerr << "      --save-image ARCH" << endl;
+  cerr << "                      Guardar la memoria ensamblada como imagen binaria (.simg) en vez de ejecutarla;" << endl;
+  cerr << "                      las imágenes se cargan sin ensamblar donde se acepta un programa" << endl;
+  cerr << "  -p, --profile ARCH  Ejecutar con el motor classic y escribir el perfil de ejecución en ARCH" << endl;
+  cerr << "                      (- para escribirlo en la salida después del estado final)" << endl;
+  cerr << "  -b, --batch         Ejecutar un lote de programas" << endl;
+  cerr << "  -v, --variants ARCH Ejecutar el programa con cada variante de ARCH (celdas DIR=PALABRA por línea)" << endl;
+  cerr << "                      en el motor SIMD; las máquinas que se separan terminan con --engine" << endl;
+  cerr << "      --fork-at K     Con --variants: ejecutar hasta el paso K y bifurcar ahí una máquina por variante" << endl;
+  cerr << "  -j, --jobs N        Hilos del modo por lotes (0 = uno por procesador, por omisión)" << endl;
+  cerr << "      --benchmark     Medir los programas dados (por omisión el directorio benchmarks) con todos" << endl;
+  cerr << "                      los motores, o sólo con --engine; -n es el número de pasos (10000000 por omisión)" << endl;
+  cerr << "  -c, --checkpoint ARCH" << endl;
+  cerr << "                      Escribir un punto de control de la ejecución en ARCH cada cierto número de" << endl;
+  cerr << "                      instrucciones (se reemplaza con escritura atómica)" << endl;
+  cerr << "      --checkpoint-every N" << endl;
+  cerr << "                      Instrucciones entre puntos de control (" << CHECKPOINTEVERY << " por omisión)" << endl;
+  cerr << "      --resume        Con --checkpoint: continuar desde el punto de control si existe" << endl;
+  cerr << "      --trace ARCH    Grabar el trazo binario de la ejecución en ARCH (motor de tabla sin superinstrucciones)" << endl;
+  cerr << "      --replay ARCH   Reproducir un trazo en vez de ejecutar un programa y escribir el estado final" << endl;
+  cerr << "      --at N          Con --replay: escribir el estado después de la instrucción N" << endl;
+  cerr << "      --animate K     Con --replay: mostrar con la animación las K instrucciones siguientes" << endl;
+  cerr << "      --interval S    Segundos entre los cuadros de --animate (0.5 por omisión)" << endl;
+  cerr << "  -t, --time          Mostrar en stderr el tiempo de ejecución e instrucciones por segundo" << endl;
+  cerr << "  -h, --help          Mostrar esta ayuda" << endl;
 }
 
 /*
-  Funcion que realiza la operacion JMP.
-  Parametros: ninguno.
-  Valor de retorno: ninguno.
+  Funcion que carga y ejecuta un programa (o un lote de programas) sin el menú interactivo.
+  Parámetros: los argumentos de la linea de comandos.
+  Valor de retorno: codigo de salida (0 exito, 1 error al cargar, 2 argumentos no validos).
 */
-void opJMP(string sDireccionamiento, string sExtra) {
-	int iDir, iTemp;
-  string sContenido;
+int runFromCommandLine(int argc, char *argv[]) {
+  string format = "text", aotFile, variantsFile, profileFile, checkpointFile, traceFile, replayFile, imageFile;
+  vector<string> fileNames;
+  long long maxSteps = 0, forkAt = 0, checkpointEvery = CHECKPOINTEVERY, replayAt = -1, animateSteps = 0;
+  Engine engine = ENGINE_GOTO;
+  bool showTime = false, batch = false, fusion = true, benchmark = false, engineGiven = false, resumeRun = false;
+  bool intervalGiven = false;
+  int jobs = 0;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+
+    if (arg == "-h" || arg == "--help") {
+      showUsage(argv[0]);
+      return 0;
+    } else if ((arg == "-n" || arg == "--steps") && i + 1 < argc) {
+      maxSteps = atoll(argv[++i]);
+    } else if ((arg == "-f" || arg == "--format") && i + 1 < argc) {
+      format = argv[++i];
+      if (format != "text" && format != "json") {
+        cerr << "Formato no válido: " << format << endl;
+        return 2;
+      }
+    } else if ((arg == "-e" || arg == "--engine") && i + 1 < argc) {
+      string name = argv[++i];
+      if (!parseEngine(name, engine)) {
+        cerr << "Motor no válido: " << name << endl;
+        return 2;
+      }
+      engineGiven = true;
+    } else if (arg == "--aot" && i + 1 < argc) {
+      aotFile = argv[++i];
+    } else if ((arg == "-p" || arg == "--profile") && i + 1 < argc) {
+      profileFile = argv[++i];
+    } else if (arg == "--no-fusion") {
+      fusion = false;
+    } else if ((arg == "-v" || arg == "--variants") && i + 1 < argc) {
+      variantsFile = argv[++i];
+    } else if (arg == "--fork-at" && i + 1 < argc) {
+      forkAt = atoll(argv[++i]);
+    } else if ((arg == "-c" || arg == "--checkpoint") && i + 1 < argc) {
+      checkpointFile = argv[++i];
+    } else if (arg == "--checkpoint-every" && i + 1 < argc) {
+      checkpointEvery = atoll(argv[++i]);
+    } else if (arg == "--resume") {
+      resumeRun = true;
+    } else if (arg == "--save-image" && i + 1 < argc) {
+      imageFile = argv[++i];
+    } else if (arg == "--trace" && i + 1 < argc) {
+      traceFile = argv[++i];
+    } else if (arg == "--replay" && i + 1 < argc) {
+      replayFile = argv[++i];
+    } else if (arg == "--at" && i + 1 < argc) {
+      replayAt = atoll(argv[++i]);
+    } else if (arg == "--animate" && i + 1 < argc) {
+      animateSteps = atoll(argv[++i]);
+    } else if (arg == "--interval" && i + 1 < argc) {
+      secs = max(0.0, atof(argv[++i]));
+      intervalGiven = true;
+    } else if (arg == "--benchmark") {
+      benchmark = true;
+    } else if (arg == "-b" || arg == "--batch") {
+      batch = true;
+    } else if ((arg == "-j" || arg == "--jobs") && i + 1 < argc) {
+      jobs = atoi(argv[++i]);
+    } else if (arg == "-t" || arg == "--time") {
+      showTime = true;
+    } else if (arg[0] != '-' || arg == "-") {
+      fileNames.push_back(arg);
+    } else {
+      cerr << "Argumento no válido: " << arg << endl << endl;
+      showUsage(argv[0]);
+      return 2;
+    }
+  }
 
-  switch (sDireccionamiento[0]) {
-    // Absoluto
-    case '1': {
-      PCprev = PC;
-     	PC = atoi(sExtra.c_str());
-      displayChanges();
-      break;
+  if (benchmark) {
+    vector<Engine> engines;
+    for (int e = 0; e < ENGINECOUNT; e++) {
+      if (!engineGiven || e == engine)
+        engines.push_back((Engine) e);
     }
-    // Indirecto
-    case '2': {
-    	MAR = sExtra;
-      displayChanges();
-    	iDir = atoi(MAR.c_str());
-      MDR = data[iDir]; // MMREad
-      displayChanges();
-      MAR = MDR;
-      displayChanges();
-      iDir = atoi(MAR.c_str());
-      MDR = data[iDir]; // MMRead
-      displayChanges();
-      PCprev = PC;
-      PC = atoi(MDR.c_str());
-      displayChanges();
-      break;
+    if (fileNames.empty())
+      fileNames.push_back("benchmarks");
+    onlyShowErrors = true;
+    return runBenchmarks(fileNames, maxSteps > 0 ? maxSteps : 10000000, engines, fusion, format);
+  }
+
+  if (replayFile != "") {
+    if (!fileNames.empty() || batch || benchmark || traceFile != "" || checkpointFile != "" || profileFile != ""
+        || aotFile != "" || variantsFile != "") {
+      showUsage(argv[0]);
+      return 2;
     }
-    // Relativo
-    case '4': {
-     	iTemp = atoi(sExtra.c_str());
-      if (PC + iTemp < 0 || PC + iTemp > 999) {
-       	cout << "OUT OF BOUNDS" << endl;
-      }
-      else {
-        if (PC + iTemp < 100) {
-          if (PC + iTemp < 10) {
-            MAR = "00" + toString(PC + iTemp);
-          }
-          else {
-            MAR = "0" + toString(PC + iTemp);
-          }
-        }
-        else {
-          MAR = toString(PC + iTemp);
-        }
-        displayChanges();
-        PCprev = PC;
-        PC = atoi(MAR.c_str());
-        displayChanges();
-      }
-    	break;
-		}
-    default: {
-    	cout << "INPUT ERROR" << endl;
+    if (!intervalGiven)
+      secs = 0.5;
+    return replayTrace(replayFile, replayAt, animateSteps, format);
+  }
+
+  if (fileNames.empty() || (!batch && fileNames.size() > 1) || (batch && (aotFile != "" || variantsFile != ""))
+      || (aotFile != "" && variantsFile != "") || (forkAt > 0 && variantsFile == "")
+      || (profileFile != "" && (batch || aotFile != "" || variantsFile != ""))
+      || (checkpointFile != "" && (batch || aotFile != "" || variantsFile != "" || profileFile != ""))
+      || (resumeRun && checkpointFile == "") || checkpointEvery <= 0
+      || (traceFile != "" && (batch || aotFile != "" || variantsFile != "" || profileFile != "" || checkpointFile != ""))
+      || (imageFile != "" && (batch || aotFile != "" || variantsFile != "" || profileFile != "" || checkpointFile != ""
+                              || traceFile != ""))) {
+    showUsage(argv[0]);
+    return 2;
+  }
+
+  // El perfil sólo lo llena el motor clásico.
+  if (profileFile != "") {
+    if (engineGiven && engine != ENGINE_CLASSIC) {
+      cerr << "El perfil de ejecución sólo está disponible con el motor classic." << endl;
+      return 2;
     }
+    engine = ENGINE_CLASSIC;
+  }
+  if (traceFile != "" && engineGiven) {
+    cerr << "El trazo se graba con su propio motor (tabla sin superinstrucciones); no se puede usar --engine." << endl;
+    return 2;
   }
-}
 
-/*
-  Funcion que ejecuta las instrucciones que se encuentren en la memoria
-  Parámetros: ninguno.
-  Valor de retorno: ninguno.
-*/
-void execute() {
-  string sOpCode, sAdType, sExtra;
-  bool bContinue = true;
-  PC = 0;
-  PCprev = 0;
-  displayChanges();
+  onlyShowErrors = true;
 
+  BatchOptions options;
+  options.maxSteps = maxSteps;
+  options.engine = engine;
+  options.format = format;
+  options.fusion = fusion;
 
-  while (PC < 1000 && bContinue) {
+  if (batch)
+    return runBatch(fileNames, options, jobs, showTime);
 
-  	IR = data[PC];
+  string fileName = fileNames[0];
+  sim.headlessMode = true;
+  sim.fusionEnabled = fusion;
 
-    if (IR != "" && IR[0] != '+' && IR[0] != '-') {
-    	sOpCode = IR.substr(0,2);
-    	sAdType = IR.substr(2, 1);
-      sExtra = IR.substr(3, 3);
+  if (!sim.loadProgramFile(fileName, cerr))
+    return 1;
 
-      if (sOpCode != "07") {
-      	PCprev = PC++;
-      }
+  if (imageFile != "") {
+    if (!sim.saveImage(imageFile)) {
+      cerr << "No se pudo escribir el archivo " << imageFile << endl;
+      return 1;
+    }
+    return 0;
+  }
 
-       // NOP
-      if (sOpCode == "00") {
-          // JEJE SOY UN NOP e.e
-      }
-      // CLA
-      else if (sOpCode == "01") {
-          opCLA();
-      }
-      // LDA
-      else if (sOpCode == "02") {
-          opLDA(sAdType, sExtra);
-      }
-      // STA
-      else if (sOpCode == "03") {
-          opSTA(sAdType, sExtra);
-      }
-      // ADD
-      else if (sOpCode == "04") {
-          opADD(sAdType, sExtra);
-      }
-      // SUB
-      else if (sOpCode == "05") {
-          opSUB(sAdType, sExtra);
-      }
-      // NEG
-      else if (sOpCode == "06") {
-          opNEG();
-      }
-      // JMP
-      else if (sOpCode == "07") {
-      	opJMP(sAdType, sExtra);
-      }
-      // HLT
-      else if (sOpCode == "08") {
-        bContinue = false;
-        displayChanges();
-      }
+  if (variantsFile != "" && forkAt > 0)
+    return runForks(sim, fileName, variantsFile, forkAt, options, jobs, showTime);
+  if (variantsFile != "")
+    return runVariants(sim, fileName, variantsFile, options, showTime);
+
+  if (aotFile != "") {
+    ofstream out(aotFile.c_str());
+    if (!out.is_open()) {
+      cerr << "No se pudo escribir el archivo " << aotFile << endl;
+      return 1;
     }
-    else {
-     PCprev = PC++;
+    sim.writeAot(out, fileName);
+    return 0;
+  }
+
+  if (profileFile != "")
+    sim.profile.reset(new Profile());
+
+  // Con --resume y un punto de control existente, la memoria y los registros salen de él y no del programa.
+  bool fromCheckpoint = resumeRun && filesystem::exists(checkpointFile);
+  if (fromCheckpoint) {
+    if (!sim.readCheckpoint(checkpointFile)) {
+      cerr << "El punto de control " << checkpointFile << " no es válido" << endl;
+      return 1;
     }
+    cerr << "Continuando desde la instrucción " << sim.steps << endl;
   }
-}
 
-// Función que muestra el menú, lee la opción del usuario y llama la función correspondiente,
-// repitiéndose hasta que el usuario desee salir.
-// Parámetros: ninguno.
-// Valor de retorno: ninguno.
-void showMenu() {
-  int option;
+  TraceWriter writer;
+  if (traceFile != "") {
+    sim.PC = 0;
+    sim.PCprev = 0;
+    sim.steps = 0;
+    if (!writer.open(traceFile, sim)) {
+      cerr << "No se pudo escribir el archivo " << traceFile << endl;
+      return 1;
+    }
+  }
 
-  do {
-    cout << endl << "Seleccione una opcion:" << endl;
-    cout << "  1 Ver memoria\n";
-    cout << "  2 Editar dirección de memoria (valor)\n";
-    cout << "  3 Editar dirección de memoria (ensamblador)\n";
-    cout << "  4 Cargar archivo en memoria\n";
-    cout << "  5 Vaciar memoria\n";
-    cout << "  6 Configuración\n";
-    cout << "  7 Ejecutar programa\n";
-    cout << "  0 Salir\n";
-    cout << " => ";
-    cin >> option;
+  clock_t start = clock();
+  string status = traceFile != "" ? sim.runTraced(maxSteps, writer)
+      : checkpointFile != "" ? sim.runCheckpointed(maxSteps, engine, checkpointFile, checkpointEvery, fromCheckpoint)
+      : sim.runHeadless(maxSteps, engine);
+  double elapsed = double(clock() - start) / CLOCKS_PER_SEC;
 
-    cout << endl;
+  if (traceFile != "" && !writer.close(status)) {
+    cerr << "No se pudo escribir el archivo " << traceFile << endl;
+    return 1;
+  }
 
-    switch (option) {
-      case 1: {
-        showMemory();
-        break;
-      }
-      case 2: {
-        editMemoryDirectly();
-        cout << "Presione cualquier tecla para regresar al menu..." << endl;
-        cin.ignore();
-        cin.get();
-        refreshScreen();
-        break;
-      }
-      case 3: {
-        editMemory();
-        cout << "Presione cualquier tecla para regresar al menu..." << endl;
-        cin.ignore();
-        cin.get();
-        refreshScreen();
-        break;
-      }
-      case 4: {
-        loadFile();
-        break;
-      }
-      case 5: {
-        clearMemory();
-        cout << "Presione cualquier tecla para continuar..." << endl;
-        cin.ignore();
-        cin.get();
-        refreshScreen();
-        break;
-      }
-      case 6: {
-        refreshScreen();
-        showOptions();
-        refreshScreen();
-        break;
-      }
-      case 7: {
-       	execute();
-        cout << "Ejecución exitosa." << endl;
-        WAIT(3 * CONV);
-        break;
-      }
-      case 0: {
-        break;
-      }
-      default: {
-        cout << endl << "Por favor seleccione una opción valida." << endl;
-        break;
-      }
+  sim.dumpState(cout, format, status);
+
+  if (profileFile == "-") {
+    cout << endl;
+    sim.writeProfile(cout);
+  } else if (profileFile != "") {
+    ofstream out(profileFile.c_str());
+    if (!out.is_open()) {
+      cerr << "No se pudo escribir el archivo " << profileFile << endl;
+      return 1;
     }
-  } while(option != 0);
+    sim.writeProfile(out);
+  }
+
+  if (showTime) {
+    cerr << sim.steps << " instrucciones en " << elapsed << " s";
+    if (elapsed > 0)
+      cerr << " (" << fixed << setprecision(0) << sim.steps / elapsed << " instr/s)";
+    cerr << endl;
+  }
+
+  return 0;
 }
 
-int main() {
+int main(int argc, char *argv[]) {
 
     setlocale(LC_CTYPE, "Spanish");
-    emptyMemory();
+
+    if(argc > 1)
+      return runFromCommandLine(argc, argv);
 
     showMenu();
 